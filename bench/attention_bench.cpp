@@ -0,0 +1,134 @@
+// bench/attention_bench.cpp (Per-token attention latency vs. context length: windowed, full, parallel)
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "attention.hpp"
+
+// A synthetic model in the trainer's layout: every token has a p_next distribution of
+// DIST_SIZE entries, and p_prev is its inversion, so contexts produced by walking p_next
+// attend to each other the way real text does.
+struct SyntheticModel {
+    static const size_t DIST_SIZE = 32;
+    std::vector<std::vector<ProbEntry>> next;
+    std::vector<std::vector<ProbEntry>> prev;
+
+    SyntheticModel(uint32_t vocab_size, uint64_t seed) : next(vocab_size), prev(vocab_size) {
+        std::mt19937_64 gen(seed);
+        for (uint32_t t = 0; t < vocab_size; ++t) {
+            float total = 0.0f;
+            for (size_t i = 0; i < DIST_SIZE; ++i) {
+                // Mostly a small neighbourhood of t, so walks revisit tokens. Ids are distinct
+                // within a distribution, as the trainer writes them and scatter_add requires.
+                uint32_t target;
+                do {
+                    target = (gen() % 4 == 0) ? gen() % vocab_size : (t + 1 + gen() % 256) % vocab_size;
+                } while (std::any_of(next[t].begin(), next[t].end(), [&](const ProbEntry& e) { return e.token_id == target; }));
+                float p = 1.0f / (i + 1);
+                next[t].push_back(ProbEntry{target, p});
+                total += p;
+            }
+            for (ProbEntry& e : next[t]) {
+                e.probability /= total;
+                prev[e.token_id].push_back(ProbEntry{t, e.probability});
+            }
+        }
+        for (auto& d : prev) {
+            std::sort(d.begin(), d.end(), [](const ProbEntry& a, const ProbEntry& b) { return a.probability > b.probability; });
+            if (d.size() > DIST_SIZE) d.resize(DIST_SIZE);
+        }
+    }
+
+    static Distribution view(const std::vector<ProbEntry>& d) { return Distribution{d.data(), d.size()}; }
+
+    std::vector<uint32_t> walk(size_t length, uint64_t seed) const {
+        std::mt19937_64 gen(seed);
+        std::vector<uint32_t> ids(1, static_cast<uint32_t>(gen() % next.size()));
+        while (ids.size() < length) ids.push_back(next[ids.back()][gen() % DIST_SIZE].token_id);
+        return ids;
+    }
+};
+
+// Microseconds per continuing-mode attention pass after the last token of `ids`.
+static double measure_us_per_token(const SyntheticModel& model, const std::vector<uint32_t>& ids, const AttentionConfig& cfg,
+                                   std::vector<float>& scores, int iterations) {
+    AttentionWorkspace ws;
+    uint32_t last = ids.back();
+    auto next_of = [&](uint32_t token_id) { return SyntheticModel::view(model.next[token_id]); };
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        collect_attention_terms(ids.data(), ids.size(), cfg, ws.terms);
+        accumulate_attention(ws, last, SyntheticModel::view(model.prev[last]), next_of, 10000.0f, cfg, scores.data(), scores.size());
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+// Scores after the last token of `ids`, from zero.
+static std::vector<float> attention_scores(const SyntheticModel& model, const std::vector<uint32_t>& ids, const AttentionConfig& cfg) {
+    AttentionWorkspace ws;
+    std::vector<float> scores(model.next.size(), 0.0f);
+    uint32_t last = ids.back();
+    auto next_of = [&](uint32_t token_id) { return SyntheticModel::view(model.next[token_id]); };
+    collect_attention_terms(ids.data(), ids.size(), cfg, ws.terms);
+    accumulate_attention(ws, last, SyntheticModel::view(model.prev[last]), next_of, 10000.0f, cfg, scores.data(), scores.size());
+    return scores;
+}
+
+int main(int argc, char** argv) {
+    uint32_t vocab_size = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 32000;
+    SyntheticModel model(vocab_size, 7);
+    std::vector<float> scores(vocab_size, 0.0f);
+
+    AttentionConfig full;
+    full.window = 0;
+    full.parallel_min_terms = 0;
+    AttentionConfig full_parallel;
+    full_parallel.window = 0;
+    AttentionConfig windowed;
+    windowed.window = 64;
+    AttentionConfig decayed;
+    decayed.window = 256;
+    decayed.decay = 0.95f;
+
+    // The parallel path must reproduce the serial scores bit for bit, or fixed-seed output
+    // would change as a context crosses parallel_min_terms.
+    AttentionConfig always_parallel = full_parallel;
+    always_parallel.parallel_min_terms = 16;
+    for (size_t length : {1024, 20000}) {
+        std::vector<uint32_t> ids = model.walk(length, length + 1);
+        std::vector<float> serial = attention_scores(model, ids, full);
+        std::vector<float> parallel = attention_scores(model, ids, always_parallel);
+        for (size_t i = 0; i < serial.size(); ++i) {
+            if (std::memcmp(&serial[i], &parallel[i], sizeof(float)) != 0) {
+                std::cerr << "Mismatch at score " << i << " of a " << length << "-token context: " << std::setprecision(9)
+                          << serial[i] << " serial vs " << parallel[i] << " parallel" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::cout << "us/token  (vocab " << vocab_size << ", " << SyntheticModel::DIST_SIZE << " entries per distribution, "
+              << omp_get_max_threads() << " threads)\n";
+    std::cout << std::setw(10) << "context" << std::setw(14) << "full" << std::setw(14) << "full,parallel" << std::setw(14) << "window=" + std::to_string(windowed.window)
+              << std::setw(20) << "window=256,d=0.95" << "\n";
+    for (size_t length = 64; length <= 65536; length *= 4) {
+        std::vector<uint32_t> ids = model.walk(length, length);
+        int iterations = static_cast<int>(std::max<size_t>(20, 2000000 / length));
+        double t_full = measure_us_per_token(model, ids, full, scores, iterations);
+        double t_parallel = measure_us_per_token(model, ids, full_parallel, scores, iterations);
+        double t_windowed = measure_us_per_token(model, ids, windowed, scores, 2000);
+        double t_decayed = measure_us_per_token(model, ids, decayed, scores, 2000);
+        std::cout << std::setw(10) << length << std::fixed << std::setprecision(2) << std::setw(14) << t_full << std::setw(14) << t_parallel
+                  << std::setw(14) << t_windowed << std::setw(20) << t_decayed << "\n";
+    }
+
+    float sink = 0.0f;
+    for (float s : scores) sink += s;
+    return sink < 0.0f; // keep the work observable
+}
@@ -0,0 +1,84 @@
+// bench/serve_loadgen.cpp (Concurrent closed-loop load against `fmm serve`)
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include "protocol.hpp"
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <unix:path|tcp:port> <path_to_prompts.txt> [clients] [requests_per_client] [max_tokens]\n";
+        return 1;
+    }
+    std::string address = argv[1];
+    int clients = argc > 3 ? std::atoi(argv[3]) : 16;
+    int requests_per_client = argc > 4 ? std::atoi(argv[4]) : 50;
+    uint32_t max_tokens = argc > 5 ? static_cast<uint32_t>(std::atoi(argv[5])) : 0;
+
+    std::ifstream in(argv[2]);
+    if (!in.is_open()) {
+        std::cerr << "Error: Could not open prompts file at " << argv[2] << std::endl;
+        return 1;
+    }
+    std::vector<std::string> prompts;
+    for (std::string line; std::getline(in, line);) if (!line.empty()) prompts.push_back(line);
+    if (prompts.empty()) {
+        std::cerr << "Error: no prompts in " << argv[2] << std::endl;
+        return 1;
+    }
+
+    // Each client sends its next request as soon as the previous one completes.
+    std::vector<std::vector<double>> latencies(clients);
+    std::atomic<uint64_t> total_tokens{0};
+    std::atomic<int> failures{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            int fd;
+            try {
+                fd = protocol::connect_to(address);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                failures += requests_per_client;
+                return;
+            }
+            std::string completion;
+            uint32_t num_tokens;
+            for (int r = 0; r < requests_per_client; ++r) {
+                const std::string& prompt = prompts[(static_cast<size_t>(c) * requests_per_client + r) % prompts.size()];
+                auto sent = std::chrono::steady_clock::now();
+                if (!protocol::write_frame(fd, prompt, max_tokens) || !protocol::read_frame(fd, completion, num_tokens)) {
+                    failures += requests_per_client - r;
+                    break;
+                }
+                latencies[c].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+                total_tokens += num_tokens;
+            }
+            ::close(fd);
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    if (all.empty()) {
+        std::cerr << "No requests completed." << std::endl;
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    std::cout << clients << " clients, " << all.size() << " requests in " << seconds << " s ("
+              << failures.load() << " failed)\n"
+              << "throughput: " << all.size() / seconds << " req/s, " << total_tokens.load() / seconds << " tokens/s\n"
+              << "latency ms: p50 " << percentile(0.50) << ", p90 " << percentile(0.90) << ", p99 " << percentile(0.99)
+              << ", max " << all.back() << std::endl;
+    return failures.load() == 0 ? 0 : 1;
+}
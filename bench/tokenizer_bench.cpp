@@ -0,0 +1,61 @@
+// bench/tokenizer_bench.cpp (MB/s of WordTokenizer vs. the istringstream tokenize())
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "utils.hpp"
+#include "tokenizer.hpp"
+
+static std::string make_corpus(size_t bytes, uint64_t seed) {
+    static const char* words[] = {"the", "Model", "answers", "questions,", "quickly.", "(and)", "HNSW", "index:",
+                                  "tokens", "\"quoted\"", "don't", "42", "e-mail", "LMDB", "cache;", "[RESPONSE]"};
+    std::mt19937_64 gen(seed);
+    std::string s;
+    s.reserve(bytes + 32);
+    while (s.size() < bytes) {
+        s += words[gen() % (sizeof(words) / sizeof(words[0]))];
+        s += (gen() % 10 == 0) ? '\n' : ' ';
+    }
+    return s;
+}
+
+template<typename F>
+static double measure_mb_per_s(const std::string& input, int iterations, F&& fn) {
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) sink += fn(input);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (sink == 42) std::cout << ""; // keep the work observable
+    return (double)input.size() * iterations / seconds / (1024.0 * 1024.0);
+}
+
+int main(int argc, char* argv[]) {
+    size_t bytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (4u << 20);
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+    std::string corpus = make_corpus(bytes, 1234);
+
+    WordTokenizer tokenizer;
+    std::vector<std::string> reference = tokenize(corpus);
+    const auto& fast = tokenizer.tokenize(corpus);
+    if (reference.size() != fast.size()) {
+        std::cerr << "Mismatch: " << reference.size() << " vs " << fast.size() << " tokens" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < reference.size(); ++i) {
+        if (reference[i] != fast[i]) {
+            std::cerr << "Mismatch at token " << i << ": '" << reference[i] << "' vs '" << fast[i] << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    double baseline = measure_mb_per_s(corpus, iterations, [](const std::string& s) { return tokenize(s).size(); });
+    double optimized = measure_mb_per_s(corpus, iterations, [&](const std::string& s) { return tokenizer.tokenize(s).size(); });
+    std::cout << "input: " << bytes << " bytes, " << reference.size() << " tokens, " << iterations << " iterations" << std::endl;
+    std::cout << "tokenize()              " << baseline << " MB/s" << std::endl;
+    std::cout << "WordTokenizer::tokenize " << optimized << " MB/s (" << optimized / baseline << "x)" << std::endl;
+    return 0;
+}
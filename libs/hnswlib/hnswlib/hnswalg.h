@@ -9,6 +9,13 @@
 #include <unordered_set>
 #include <list>
 #include <memory>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HNSWLIB_HAS_MMAP
+#endif
 
 namespace hnswlib {
 typedef unsigned int tableint;
@@ -64,12 +71,21 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     mutable std::atomic<long> metric_distance_computations{0};
     mutable std::atomic<long> metric_hops{0};
+    // When set, searches also count base-layer hops and distances (searchBaseLayerST's
+    // collect_metrics); the upper-layer descent is always counted.
+    std::atomic<bool> collect_metrics_{false};  // may be flipped while other threads search
 
     bool allow_replace_deleted_ = false;  // flag to replace deleted elements (marked as deleted) during insertions
 
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    // Set by loadIndexReadOnly: level 0 and the upper-level link lists point into a shared,
+    // read-only mapping of the index file instead of private heap copies.
+    bool read_only_{false};
+    char *mapped_file_{nullptr};
+    size_t mapped_size_{0};
+
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
     }
@@ -149,12 +165,21 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
-        data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
+        if (read_only_) {
+#ifdef HNSWLIB_HAS_MMAP
+            munmap(mapped_file_, mapped_size_);
+#endif
+            mapped_file_ = nullptr;
+            mapped_size_ = 0;
+            read_only_ = false;
+        } else {
+            free(data_level0_memory_);
+            for (tableint i = 0; i < cur_element_count; i++) {
+                if (element_levels_[i] > 0)
+                    free(linkLists_[i]);
+            }
         }
+        data_level0_memory_ = nullptr;
         free(linkLists_);
         linkLists_ = nullptr;
         cur_element_count = 0;
@@ -162,6 +187,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    void checkWritable() const {
+        if (read_only_)
+            throw std::runtime_error("Index is memory-mapped read-only");
+    }
+
+
+    bool isReadOnly() const {
+        return read_only_;
+    }
+
+
     struct CompareByFirst {
         constexpr bool operator()(std::pair<dist_t, tableint> const& a,
             std::pair<dist_t, tableint> const& b) const noexcept {
@@ -170,6 +206,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     };
 
 
+    void setCollectMetrics(bool collect) {
+        collect_metrics_.store(collect, std::memory_order_relaxed);
+    }
+
+
     void setEf(size_t ef) {
         ef_ = ef;
     }
@@ -631,6 +672,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     void resizeIndex(size_t new_max_elements) {
+        checkWritable();
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
 
@@ -822,8 +864,107 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    template<typename T>
+    static void readMappedPOD(const char *&pos, const char *end, T &podRef) {
+        if ((size_t) (end - pos) < sizeof(T))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        memcpy((char *) &podRef, pos, sizeof(T));
+        pos += sizeof(T);
+    }
+
+
+    /*
+    * Maps an index written by saveIndex read-only with mmap. Level 0 and the upper-level link
+    * lists are used in place, so pages come from the shared page cache and load does not copy
+    * the graph. The index cannot be modified, is not resizable, has no label lookup table
+    * and does not count deleted elements up front (searches check the marks instead).
+    */
+    void loadIndexReadOnly(const std::string &location, SpaceInterface<dist_t> *s) {
+#ifndef HNSWLIB_HAS_MMAP
+        throw std::runtime_error("loadIndexReadOnly requires mmap");
+#else
+        int fd = ::open(location.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat file");
+        }
+        size_t total_filesize = st.st_size;
+        void *mapping = total_filesize ? mmap(nullptr, total_filesize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Cannot mmap index file");
+
+        clear();
+        mapped_file_ = (char *) mapping;
+        mapped_size_ = total_filesize;
+        read_only_ = true;
+
+        const char *pos = mapped_file_;
+        const char *end = mapped_file_ + total_filesize;
+        size_t cur_element_count_read;
+        readMappedPOD(pos, end, offsetLevel0_);
+        readMappedPOD(pos, end, max_elements_);
+        readMappedPOD(pos, end, cur_element_count_read);
+        readMappedPOD(pos, end, size_data_per_element_);
+        readMappedPOD(pos, end, label_offset_);
+        readMappedPOD(pos, end, offsetData_);
+        readMappedPOD(pos, end, maxlevel_);
+        readMappedPOD(pos, end, enterpoint_node_);
+        readMappedPOD(pos, end, maxM_);
+        readMappedPOD(pos, end, maxM0_);
+        readMappedPOD(pos, end, M_);
+        readMappedPOD(pos, end, mult_);
+        readMappedPOD(pos, end, ef_construction_);
+        max_elements_ = cur_element_count_read;
+
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        dist_func_param_ = s->get_dist_func_param();
+
+        if ((size_t) (end - pos) < cur_element_count_read * size_data_per_element_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        data_level0_memory_ = (char *) pos;
+        pos += cur_element_count_read * size_data_per_element_;
+
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+
+        linkLists_ = (char **) malloc(sizeof(void *) * std::max<size_t>(cur_element_count_read, 1));
+        if (linkLists_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndexReadOnly failed to allocate linklists");
+        element_levels_ = std::vector<int>(cur_element_count_read);
+        for (size_t i = 0; i < cur_element_count_read; i++) {
+            unsigned int linkListSize;
+            readMappedPOD(pos, end, linkListSize);
+            if ((size_t) (end - pos) < linkListSize)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            element_levels_[i] = linkListSize / size_links_per_element_;
+            linkLists_[i] = linkListSize ? (char *) pos : nullptr;
+            pos += linkListSize;
+        }
+        if (pos != end)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        cur_element_count = cur_element_count_read;
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements_));
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+        num_deleted_ = 0;
+#ifdef MADV_RANDOM
+        // Graph traversal jumps around the file; skip read-ahead of neighbouring pages.
+        madvise(mapped_file_, mapped_size_, MADV_RANDOM);
+#endif
+#endif
+    }
+
+
     template<typename data_t>
     std::vector<data_t> getDataByLabel(labeltype label) const {
+        if (read_only_)
+            throw std::runtime_error("Label lookups are not available on a read-only index");
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
         
@@ -851,6 +992,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * Marks an element with the given label deleted, does NOT really change the current graph.
     */
     void markDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
@@ -893,6 +1035,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     *  because elements marked as deleted can be completely removed by addPoint
     */
     void unmarkDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
@@ -952,6 +1095,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
+        checkWritable();
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
@@ -1151,6 +1295,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     tableint addPoint(const void *data_point, labeltype label, int level) {
+        checkWritable();
         tableint cur_c = 0;
         {
             // Checking if the element with the same label already exists
@@ -1303,13 +1448,24 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+        // A read-only index never counted its deletions, so it always checks the marks.
+        bool bare_bone_search = !num_deleted_ && !isIdAllowed && !read_only_;
         if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+            if (collect_metrics_.load(std::memory_order_relaxed)) {
+                top_candidates = searchBaseLayerST<true, true>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed);
+            } else {
+                top_candidates = searchBaseLayerST<true>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed);
+            }
         } else {
-            top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+            if (collect_metrics_.load(std::memory_order_relaxed)) {
+                top_candidates = searchBaseLayerST<false, true>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed);
+            } else {
+                top_candidates = searchBaseLayerST<false>(
+                        currObj, query_data, std::max(ef_, k), isIdAllowed);
+            }
         }
 
         while (top_candidates.size() > k) {
@@ -1363,12 +1519,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        if (collect_metrics_.load(std::memory_order_relaxed)) {
+            top_candidates = searchBaseLayerST<false, true>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        } else {
+            top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        }
 
         size_t sz = top_candidates.size();
         result.resize(sz);
         while (!top_candidates.empty()) {
-            result[--sz] = top_candidates.top();
+            result[--sz] = std::pair<dist_t, labeltype>(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
             top_candidates.pop();
         }
 
@@ -273,4 +273,113 @@ class EpsilonSearchStopCondition : public BaseSearchStopCondition<dist_t> {
 
     ~EpsilonSearchStopCondition() {}
 };
+
+// k-NN search that stops once a weighted vote over the results' outcomes is decided.
+// Each result votes for outcome_of(label) with weight 1 / (1 + dist). Candidates are
+// expanded closest first, so results no farther than the current candidate are taken as
+// settled (the same greedy assumption as the usual ef termination); the search ends as soon
+// as the leader's settled weight beats the runner-up's by more than the remaining slots
+// could add, each at most 1 / (1 + candidate_dist).
+template<typename dist_t>
+class OutcomeVoteStopCondition : public BaseSearchStopCondition<dist_t> {
+ public:
+    typedef size_t (*OutcomeFunc)(labeltype);
+
+ private:
+    struct Result {
+        dist_t dist;
+        labeltype label;
+        size_t outcome;
+    };
+
+    OutcomeFunc outcome_of_;
+    size_t k_;
+    size_t min_settled_;
+    std::vector<Result> results_;
+    std::vector<std::pair<size_t, float>> votes_;
+    bool decided_early_;
+
+    bool vote_is_decided(dist_t candidate_dist) {
+        if (results_.size() < k_) return false;
+        votes_.clear();
+        size_t settled = 0;
+        for (const Result& r : results_) {
+            if (r.dist > candidate_dist) continue;
+            settled++;
+            float weight = 1.0f / (1.0f + (float) r.dist);
+            size_t v = 0;
+            while (v < votes_.size() && votes_[v].first != r.outcome) v++;
+            if (v == votes_.size()) votes_.emplace_back(r.outcome, 0.0f);
+            votes_[v].second += weight;
+        }
+        if (settled < min_settled_ || settled >= k_) return false; // all settled: the ef rule applies
+        float leader = 0.0f, runner_up = 0.0f;
+        for (const auto& vote : votes_) {
+            if (vote.second > leader) {
+                runner_up = leader;
+                leader = vote.second;
+            } else if (vote.second > runner_up) {
+                runner_up = vote.second;
+            }
+        }
+        float max_gain = (k_ - settled) / (1.0f + (float) candidate_dist);
+        return leader - runner_up > max_gain;
+    }
+
+ public:
+    OutcomeVoteStopCondition(OutcomeFunc outcome_of, size_t k, size_t min_settled = 1) {
+        outcome_of_ = outcome_of;
+        k_ = k;
+        min_settled_ = min_settled;
+        decided_early_ = false;
+        results_.reserve(k + 1);
+    }
+
+    void add_point_to_result(labeltype label, const void *datapoint, dist_t dist) override {
+        results_.push_back(Result{dist, label, outcome_of_(label)});
+    }
+
+    void remove_point_from_result(labeltype label, const void *datapoint, dist_t dist) override {
+        // `dist` is the incoming candidate's distance, not the removed one's: match by label.
+        for (size_t i = 0; i < results_.size(); i++) {
+            if (results_[i].label == label) {
+                results_[i] = results_.back();
+                results_.pop_back();
+                return;
+            }
+        }
+    }
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        if (candidate_dist > lowerBound && results_.size() == k_) {
+            return true;
+        }
+        if (vote_is_decided(candidate_dist)) {
+            decided_early_ = true;
+            return true;
+        }
+        return false;
+    }
+
+    bool should_consider_candidate(dist_t candidate_dist, dist_t lowerBound) override {
+        return results_.size() < k_ || lowerBound > candidate_dist;
+    }
+
+    bool should_remove_extra() override {
+        return results_.size() > k_;
+    }
+
+    void filter_results(std::vector<std::pair<dist_t, labeltype >> &candidates) override {
+        while (candidates.size() > k_) {
+            candidates.pop_back();
+        }
+    }
+
+    // Whether the last search ended on the vote rather than on the usual ef rule.
+    bool decided_early() const {
+        return decided_early_;
+    }
+
+    ~OutcomeVoteStopCondition() {}
+};
 }  // namespace hnswlib
@@ -0,0 +1,87 @@
+// This is a test file for testing the interface
+//  >>> void loadIndexReadOnly(const std::string &location, SpaceInterface<dist_t> *s)
+// of class HierarchicalNSW
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void test() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 50;
+    size_t k = 10;
+    std::string path = "mmap_load_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    for (idx_t i = 0; i < n * d; ++i) {
+        data[i] = distrib(rng);
+    }
+    for (idx_t i = 0; i < nq * d; ++i) {
+        query[i] = distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float>* alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n);
+    for (size_t i = 0; i < n; ++i) {
+        alg_hnsw->addPoint(data.data() + d * i, i * 3);
+    }
+    alg_hnsw->saveIndex(path);
+
+    hnswlib::HierarchicalNSW<float>* alg_loaded = new hnswlib::HierarchicalNSW<float>(&space, path);
+    hnswlib::HierarchicalNSW<float>* alg_mapped = new hnswlib::HierarchicalNSW<float>(&space);
+    alg_mapped->loadIndexReadOnly(path, &space);
+
+    assert(alg_mapped->isReadOnly());
+    assert(alg_mapped->getCurrentElementCount() == n);
+    assert(alg_mapped->maxlevel_ == alg_loaded->maxlevel_);
+    assert(alg_mapped->enterpoint_node_ == alg_loaded->enterpoint_node_);
+
+    // the mapped index must return exactly what the copied one does
+    for (size_t j = 0; j < nq; ++j) {
+        const void* p = query.data() + j * d;
+        auto expected = alg_loaded->searchKnnCloserFirst(p, k);
+        auto res = alg_mapped->searchKnnCloserFirst(p, k);
+        assert(expected.size() == res.size());
+        for (size_t i = 0; i < res.size(); ++i) {
+            assert(expected[i] == res[i]);
+        }
+    }
+
+    bool thrown = false;
+    try {
+        alg_mapped->addPoint(data.data(), n * 3);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    delete alg_hnsw;
+    delete alg_loaded;
+    delete alg_mapped;
+    remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
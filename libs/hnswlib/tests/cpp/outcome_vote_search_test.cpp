@@ -0,0 +1,139 @@
+// This is a test file for testing the stop condition
+//  >>> class OutcomeVoteStopCondition
+// used with searchStopConditionClosest of class HierarchicalNSW
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+const size_t NUM_OUTCOMES = 64;
+
+size_t outcome_of(hnswlib::labeltype label) {
+    return label % NUM_OUTCOMES;
+}
+
+// L2 space that counts distance computations.
+long num_distances = 0;
+
+float CountingL2Sqr(const void *a, const void *b, const void *qty_ptr) {
+    num_distances++;
+    return hnswlib::L2Sqr(a, b, qty_ptr);
+}
+
+class CountingL2Space : public hnswlib::SpaceInterface<float> {
+    size_t dim_;
+
+ public:
+    explicit CountingL2Space(size_t dim) : dim_(dim) {}
+    size_t get_data_size() override { return dim_ * sizeof(float); }
+    hnswlib::DISTFUNC<float> get_dist_func() override { return CountingL2Sqr; }
+    void *get_dist_func_param() override { return &dim_; }
+};
+
+size_t vote(const std::vector<std::pair<float, hnswlib::labeltype>> &results) {
+    std::vector<float> weights(NUM_OUTCOMES, 0.0f);
+    for (const auto &r : results) {
+        weights[outcome_of(r.second)] += 1.0f / (1.0f + r.first);
+    }
+    size_t best = 0;
+    for (size_t i = 1; i < NUM_OUTCOMES; i++) {
+        if (weights[i] > weights[best]) best = i;
+    }
+    return best;
+}
+
+void test() {
+    int d = 16;
+    size_t n = 10000;
+    size_t num_clusters = 40;
+    size_t nq = 200;
+    size_t k = 25;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::normal_distribution<> noise(0.0, 0.05);
+
+    // Clustered points whose outcome is mostly their cluster's, with some label noise.
+    std::vector<float> centers(num_clusters * d);
+    for (size_t i = 0; i < centers.size(); i++) {
+        centers[i] = distrib(rng);
+    }
+    CountingL2Space space(d);
+    hnswlib::HierarchicalNSW<float>* alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n);
+    std::vector<float> point(d);
+    for (size_t i = 0; i < n; i++) {
+        size_t c = i % num_clusters;
+        for (int j = 0; j < d; j++) {
+            point[j] = centers[c * d + j] + noise(rng);
+        }
+        size_t outcome = distrib(rng) < 0.8 ? c : rng() % NUM_OUTCOMES;
+        alg_hnsw->addPoint(point.data(), i * NUM_OUTCOMES + outcome);
+    }
+
+    long full_distances = 0, early_distances = 0;
+    size_t agree = 0, decided_early = 0;
+    std::vector<float> query(d);
+    for (size_t q = 0; q < nq; q++) {
+        size_t c = rng() % num_clusters;
+        for (int j = 0; j < d; j++) {
+            query[j] = centers[c * d + j] + noise(rng);
+        }
+
+        num_distances = 0;
+        auto knn = alg_hnsw->searchKnn(query.data(), k);
+        full_distances += num_distances;
+        std::vector<std::pair<float, hnswlib::labeltype>> full;
+        while (!knn.empty()) {
+            full.push_back(knn.top());
+            knn.pop();
+        }
+
+        num_distances = 0;
+        hnswlib::OutcomeVoteStopCondition<float> stop_condition(outcome_of, k);
+        std::vector<std::pair<float, hnswlib::labeltype>> early =
+            alg_hnsw->searchStopConditionClosest(query.data(), stop_condition);
+        early_distances += num_distances;
+
+        assert(!early.empty() && early.size() <= k);
+        for (size_t i = 1; i < early.size(); i++) {
+            assert(early[i - 1].first <= early[i].first);
+        }
+        agree += vote(early) == vote(full);
+        decided_early += stop_condition.decided_early();
+    }
+
+    std::cout << "vote agreement " << agree << "/" << nq << ", decided early " << decided_early << "/" << nq
+              << ", distance computations " << early_distances << " vs " << full_distances << "\n";
+    assert(agree >= nq * 95 / 100);
+    assert(decided_early > 0);
+    assert(early_distances < full_distances);
+
+    // With every outcome distinct the vote is never decided early: plain k-NN.
+    hnswlib::OutcomeVoteStopCondition<float> exact_condition([](hnswlib::labeltype label) { return (size_t) label; }, k);
+    auto exact = alg_hnsw->searchStopConditionClosest(query.data(), exact_condition);
+    assert(!exact_condition.decided_early());
+    auto knn = alg_hnsw->searchKnn(query.data(), k);
+    assert(exact.size() == knn.size());
+    for (size_t i = exact.size(); i-- > 0;) {
+        assert(exact[i].second == knn.top().second);
+        knn.pop();
+    }
+
+    delete alg_hnsw;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
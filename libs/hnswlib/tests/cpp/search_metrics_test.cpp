@@ -0,0 +1,81 @@
+// This is a test file for testing
+//  >>> void setCollectMetrics(bool collect);
+// of class HierarchicalNSW: base-layer hops and distance computations are counted only when
+// it is set, and results do not change either way
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <iostream>
+
+namespace {
+
+void test() {
+    int d = 16;
+    size_t n = 5000;
+    size_t nq = 100;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float>* alg_hnsw = new hnswlib::HierarchicalNSW<float>(&space, n);
+    std::vector<float> point(d);
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < d; j++) {
+            point[j] = distrib(rng);
+        }
+        alg_hnsw->addPoint(point.data(), i);
+    }
+
+    std::vector<float> queries(nq * d);
+    for (size_t i = 0; i < queries.size(); i++) {
+        queries[i] = distrib(rng);
+    }
+
+    long hops[2], distances[2];
+    std::vector<std::vector<hnswlib::labeltype>> labels[2];
+    for (int collect = 0; collect < 2; collect++) {
+        alg_hnsw->setCollectMetrics(collect == 1);
+        alg_hnsw->metric_hops = 0;
+        alg_hnsw->metric_distance_computations = 0;
+        for (size_t q = 0; q < nq; q++) {
+            auto result = alg_hnsw->searchKnn(queries.data() + q * d, k);
+            std::vector<hnswlib::labeltype> found;
+            while (!result.empty()) {
+                found.push_back(result.top().second);
+                result.pop();
+            }
+            labels[collect].push_back(found);
+
+            hnswlib::OutcomeVoteStopCondition<float> stop_condition([](hnswlib::labeltype label) { return (size_t) label; }, k);
+            alg_hnsw->searchStopConditionClosest(queries.data() + q * d, stop_condition);
+        }
+        hops[collect] = alg_hnsw->metric_hops;
+        distances[collect] = alg_hnsw->metric_distance_computations;
+    }
+
+    std::cout << "hops " << hops[0] << " -> " << hops[1] << ", distance computations "
+              << distances[0] << " -> " << distances[1] << "\n";
+    assert(labels[0] == labels[1]);
+    assert(hops[1] > hops[0]);
+    assert(distances[1] > distances[0]);
+    // Every search visits at least its base-layer entry point.
+    assert(hops[1] - hops[0] >= (long) (2 * nq));
+
+    delete alg_hnsw;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
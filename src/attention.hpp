@@ -0,0 +1,156 @@
+// src/attention.hpp (Windowed, distance-decayed attention over the earlier context)
+
+#ifndef FMM_ATTENTION_HPP
+#define FMM_ATTENTION_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <omp.h>
+#include "distributions.hpp"
+#include "mixing.hpp"
+
+// Which earlier tokens continuing-mode attention looks at, and how much each one counts.
+struct AttentionConfig {
+    size_t window = 0;   // most recent earlier tokens attended to; 0 = the whole context
+    float decay = 1.0f;  // weight factor per token of distance from the last one; 1 = no decay
+    size_t parallel_min_terms = 1024; // distinct terms from which accumulation uses all OpenMP threads; 0 = never
+};
+
+// Terms whose decayed weight falls below this are dropped, so decay alone also bounds the work.
+const float MIN_ATTENTION_WEIGHT = 1e-6f;
+
+// One distinct earlier token and its summed weight: a token seen m times at equal weight
+// counts m, so repeats cost a single distribution fetch.
+struct AttentionTerm {
+    uint32_t token_id;
+    float weight;
+};
+
+// One contribution buffered by the parallel path, unrounded: the owner of token_id mixes
+// it in with mixing::mix, the same multiply-add the serial path does.
+struct ScaledEntry {
+    uint32_t token_id;
+    float scale;
+    float probability;
+};
+
+// Per-context scratch for one attention pass, reused between calls.
+struct AttentionWorkspace {
+    std::vector<AttentionTerm> terms;
+    std::vector<AttentionTerm> own_terms;         // with a shared prefix: the terms after it
+    std::vector<Distribution> dists;             // parallel path: each term's p_next
+    std::vector<std::vector<ScaledEntry>> partials; // parallel path: [producer * threads + owner]
+};
+
+// Index of the first context id the window reaches when predicting after ids[n - 1].
+// Everything from there to the end (the last token included) is all a prediction reads.
+inline size_t attention_begin(size_t n, const AttentionConfig& cfg) {
+    if (n < 2) return 0;
+    size_t earlier = n - 1;
+    return (cfg.window > 0 && earlier > cfg.window) ? earlier - cfg.window : 0;
+}
+
+// Fills `terms` from ids[0, n - 1) within the window, sorted by token id. The nearest earlier
+// token has weight 1, the next `decay`, then decay^2 and so on.
+inline void collect_attention_terms(const uint32_t* ids, size_t n, const AttentionConfig& cfg, std::vector<AttentionTerm>& terms) {
+    terms.clear();
+    if (n < 2) return;
+    size_t begin = attention_begin(n, cfg);
+    float weight = 1.0f;
+    for (size_t i = n - 1; i-- > begin;) {
+        if (weight < MIN_ATTENTION_WEIGHT) break;
+        terms.push_back(AttentionTerm{ids[i], weight});
+        weight *= cfg.decay;
+    }
+    std::sort(terms.begin(), terms.end(), [](const AttentionTerm& a, const AttentionTerm& b) { return a.token_id < b.token_id; });
+    size_t out = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        if (out > 0 && terms[out - 1].token_id == terms[i].token_id) terms[out - 1].weight += terms[i].weight;
+        else terms[out++] = terms[i];
+    }
+    terms.resize(out);
+}
+
+// Merges two term lists sorted by token id into `out`, summing the weights of shared ids.
+inline void merge_attention_terms(const std::vector<AttentionTerm>& a, const std::vector<AttentionTerm>& b, std::vector<AttentionTerm>& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j == b.size() || (i < a.size() && a[i].token_id < b[j].token_id)) out.push_back(a[i++]);
+        else if (i == a.size() || b[j].token_id < a[i].token_id) out.push_back(b[j++]);
+        else {
+            out.push_back(AttentionTerm{a[i].token_id, a[i].weight + b[j].weight});
+            i++;
+            j++;
+        }
+    }
+}
+
+// One term's contribution: its next-token distribution scaled by how strongly the term and
+// the last token predict each other, P(last | term) * P(term | last) * weight * multiplier.
+// Returns 0 when the term is too weak to count.
+inline float attention_scale(const AttentionTerm& term, const Distribution& term_next, uint32_t last_token_id,
+                             const Distribution& last_prev, float multiplier) {
+    float p_last_given_prev = term_next.prob_of(last_token_id);
+    float p_prev_given_last = last_prev.prob_of(term.token_id);
+    float attention_score = p_last_given_prev * p_prev_given_last;
+    if (attention_score < 1e-9f) return 0.0f;
+    return multiplier * attention_score * term.weight;
+}
+
+// Adds every term in ws.terms to scores[0, num_scores). `next_of(token_id)` returns a token's
+// p_next Distribution and is only ever called from the calling thread, so it may read through
+// a single LMDB transaction.
+//
+// From cfg.parallel_min_terms distinct terms on, and unless already inside a parallel region
+// (batch and server workers), the terms are split across the OpenMP threads. Each thread
+// scatters its contributions into per-owner sparse buffers, one per slice of the vocabulary;
+// after a barrier each thread adds up the buffers for its own slice, so no two threads ever
+// write the same score. Each score receives the same multiply-adds in the same term order as
+// on the serial path, so both give identical scores.
+template<typename NextFn>
+inline void accumulate_attention(AttentionWorkspace& ws, uint32_t last_token_id, const Distribution& last_prev, NextFn&& next_of,
+                                 float multiplier, const AttentionConfig& cfg, float* scores, size_t num_scores) {
+    const std::vector<AttentionTerm>& terms = ws.terms;
+    int max_threads = omp_get_max_threads();
+    if (cfg.parallel_min_terms == 0 || terms.size() < cfg.parallel_min_terms || max_threads < 2 || omp_in_parallel()) {
+        for (const AttentionTerm& term : terms) {
+            Distribution prev_next = next_of(term.token_id);
+            float scale = attention_scale(term, prev_next, last_token_id, last_prev, multiplier);
+            if (scale != 0.0f) mixing::scatter_add(scores, prev_next.entries, prev_next.size, scale);
+        }
+        return;
+    }
+
+    ws.dists.resize(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i) ws.dists[i] = next_of(terms[i].token_id);
+    if (ws.partials.size() < static_cast<size_t>(max_threads) * max_threads) ws.partials.resize(static_cast<size_t>(max_threads) * max_threads);
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        size_t threads = static_cast<size_t>(omp_get_num_threads());
+        size_t self = static_cast<size_t>(omp_get_thread_num());
+        std::vector<ScaledEntry>* mine = &ws.partials[self * threads];
+        for (size_t owner = 0; owner < threads; ++owner) mine[owner].clear();
+
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const Distribution& prev_next = ws.dists[i];
+            float scale = attention_scale(terms[i], prev_next, last_token_id, last_prev, multiplier);
+            if (scale == 0.0f) continue;
+            for (size_t j = 0; j < prev_next.size; ++j) {
+                uint32_t token_id = prev_next.entries[j].token_id;
+                size_t owner = static_cast<size_t>(static_cast<uint64_t>(token_id) * threads / num_scores);
+                mine[owner].push_back(ScaledEntry{token_id, scale, prev_next.entries[j].probability});
+            }
+        } // implicit barrier: every buffer is complete
+
+        for (size_t producer = 0; producer < threads; ++producer) {
+            for (const ScaledEntry& e : ws.partials[producer * threads + self]) scores[e.token_id] = mixing::mix(scores[e.token_id], e.scale, e.probability);
+        }
+    }
+}
+
+#endif // FMM_ATTENTION_HPP
@@ -0,0 +1,533 @@
+// src/bpe.cpp (Native BPE encoder for HuggingFace tokenizer.json models)
+
+#include "bpe.hpp"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include "nlohmann/json.hpp"
+
+namespace {
+
+inline uint64_t mix_pair(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline bool is_space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+// Bytes >= 0x80 are treated as letters so multi-byte UTF-8 words stay together.
+inline bool is_letter(unsigned char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80; }
+inline bool is_digit(unsigned char c) { return c >= '0' && c <= '9'; }
+inline bool is_word(unsigned char c) { return is_letter(c) || is_digit(c) || c == '_'; }
+
+inline size_t utf8_length(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if ((lead >> 5) == 0x6) return 2;
+    if ((lead >> 4) == 0xE) return 3;
+    if ((lead >> 3) == 0x1E) return 4;
+    return 1; // stray continuation byte
+}
+
+void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// GPT-2 byte-to-unicode alphabet: printable Latin-1 bytes map to themselves, the rest are
+// shifted above U+0100 in byte order.
+uint32_t byte_level_codepoint(uint32_t b) {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> cps(256);
+        uint32_t shifted = 0;
+        for (uint32_t i = 0; i < 256; ++i) {
+            bool printable = (i >= '!' && i <= '~') || (i >= 0xA1 && i <= 0xAC) || (i >= 0xAE && i <= 0xFF);
+            cps[i] = printable ? i : 256 + shifted++;
+        }
+        return cps;
+    }();
+    return table[b];
+}
+
+uint32_t decode_utf8(const char* s, size_t len) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+    if (len == 1) return u[0];
+    if (len == 2) return ((u[0] & 0x1F) << 6) | (u[1] & 0x3F);
+    if (len == 3) return ((u[0] & 0x0F) << 12) | ((u[1] & 0x3F) << 6) | (u[2] & 0x3F);
+    return ((u[0] & 0x07) << 18) | ((u[1] & 0x3F) << 12) | ((u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+}
+
+// Min-heap on (rank, position): lowest rank first, leftmost on ties, as in HF tokenizers.
+struct CandidateAfter {
+    template<typename C>
+    bool operator()(const C& a, const C& b) const {
+        return a.rank > b.rank || (a.rank == b.rank && a.left > b.left);
+    }
+};
+
+} // namespace
+
+// --- BpeWorkspace: LRU cache of word -> ids ---
+
+BpeWorkspace::BpeWorkspace(size_t cache_capacity) : capacity(std::max<size_t>(1, cache_capacity)) {
+    entries.reserve(capacity);
+    index.reserve(capacity);
+}
+
+void BpeWorkspace::cache_unlink(uint32_t idx) {
+    CacheEntry& e = entries[idx];
+    if (e.prev != NIL) entries[e.prev].next = e.next; else head = e.next;
+    if (e.next != NIL) entries[e.next].prev = e.prev; else tail = e.prev;
+    e.prev = e.next = NIL;
+}
+
+void BpeWorkspace::cache_touch(uint32_t idx) {
+    if (head == idx) return;
+    cache_unlink(idx);
+    entries[idx].next = head;
+    if (head != NIL) entries[head].prev = idx;
+    head = idx;
+    if (tail == NIL) tail = idx;
+}
+
+const std::vector<uint32_t>* BpeWorkspace::cache_find(std::string_view word) {
+    key.assign(word.data(), word.size());
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return nullptr;
+    }
+    ++hits;
+    cache_touch(it->second);
+    return &entries[it->second].ids;
+}
+
+void BpeWorkspace::cache_insert(std::string_view word, const std::vector<uint32_t>& ids) {
+    uint32_t idx;
+    if (entries.size() < capacity) {
+        idx = static_cast<uint32_t>(entries.size());
+        entries.push_back({std::string(word), ids, NIL, NIL});
+    } else {
+        idx = tail;
+        cache_unlink(idx);
+        index.erase(entries[idx].word);
+        entries[idx].word.assign(word.data(), word.size());
+        entries[idx].ids.assign(ids.begin(), ids.end());
+    }
+    index.emplace(entries[idx].word, idx);
+    entries[idx].next = head;
+    if (head != NIL) entries[head].prev = idx;
+    head = idx;
+    if (tail == NIL) tail = idx;
+}
+
+// --- BpeEncoder ---
+
+void BpeEncoder::insert_merge(std::vector<MergeSlot>& table, uint32_t left, uint32_t right, uint32_t rank, uint32_t merged) {
+    uint64_t pair = (static_cast<uint64_t>(left) << 32) | right;
+    size_t mask = table.size() - 1;
+    for (size_t i = mix_pair(pair) & mask;; i = (i + 1) & mask) {
+        MergeSlot& slot = table[i];
+        if (slot.pair == EMPTY_PAIR) {
+            slot = {pair, rank, merged};
+            return;
+        }
+        if (slot.pair == pair) return; // keep the first (lowest) rank
+    }
+}
+
+const BpeEncoder::MergeSlot* BpeEncoder::find_merge(uint32_t left, uint32_t right) const {
+    uint64_t pair = (static_cast<uint64_t>(left) << 32) | right;
+    for (size_t i = mix_pair(pair) & merge_mask;; i = (i + 1) & merge_mask) {
+        const MergeSlot& slot = merge_table[i];
+        if (slot.pair == pair) return &slot;
+        if (slot.pair == EMPTY_PAIR) return nullptr;
+    }
+}
+
+bool BpeEncoder::compile(const std::string& tokenizerPath, const std::string& outPath) {
+    std::ifstream in(tokenizerPath);
+    if (!in.is_open()) throw std::runtime_error("Could not open tokenizer file at " + tokenizerPath);
+    nlohmann::json j = nlohmann::json::parse(in);
+
+    BpeFileHeader header{};
+    std::memcpy(header.magic, "FMMBPE\0\0", 8);
+    header.version = FORMAT_VERSION;
+    header.pre_tokenizer = static_cast<uint32_t>(PreTokenizer::NONE);
+    header.unk_id = NO_TOKEN;
+
+    std::vector<MergeSlot> table;
+    uint32_t byte_ids[256];
+    std::fill(byte_ids, byte_ids + 256, NO_TOKEN);
+    std::vector<AddedTokenRecord> added;
+    std::string prefix, suffix, added_pool;
+
+    const bool bpe = j.contains("model") && j["model"].is_object() &&
+                     j["model"].value("type", std::string("BPE")) == "BPE" && j["model"].contains("merges");
+    if (bpe) {
+        const nlohmann::json& model = j["model"];
+        // Token ids as vocab.bin will resolve them: the model vocabulary, then added tokens
+        // whose content it lacks.
+        std::unordered_map<std::string, uint32_t> ids;
+        for (auto it = model["vocab"].begin(); it != model["vocab"].end(); ++it) ids.emplace(it.key(), it.value().get<uint32_t>());
+        auto id_of = [&](const std::string& token) {
+            auto it = ids.find(token);
+            return it == ids.end() ? NO_TOKEN : it->second;
+        };
+
+        header.flags |= HAS_MODEL;
+        if (model.contains("continuing_subword_prefix") && model["continuing_subword_prefix"].is_string()) {
+            prefix = model["continuing_subword_prefix"].get<std::string>();
+        }
+        if (model.contains("end_of_word_suffix") && model["end_of_word_suffix"].is_string()) {
+            suffix = model["end_of_word_suffix"].get<std::string>();
+        }
+        if (model.contains("unk_token") && model["unk_token"].is_string()) {
+            header.unk_id = id_of(model["unk_token"].get<std::string>());
+        }
+
+        if (j.contains("added_tokens")) {
+            std::vector<std::pair<std::string, uint32_t>> tokens;
+            for (const auto& token : j["added_tokens"]) {
+                std::string content = token["content"].get<std::string>();
+                if (!content.empty()) tokens.emplace_back(std::move(content), token["id"].get<uint32_t>());
+            }
+            // Longest match first when several added tokens share a prefix.
+            std::stable_sort(tokens.begin(), tokens.end(), [](const std::pair<std::string, uint32_t>& a, const std::pair<std::string, uint32_t>& b) { return a.first.size() > b.first.size(); });
+            for (const auto& token : tokens) {
+                added.push_back({token.second, static_cast<uint32_t>(added_pool.size()), static_cast<uint32_t>(token.first.size())});
+                added_pool += token.first;
+            }
+        }
+
+        auto has_type = [](const nlohmann::json& node, const char* type) {
+            if (node.is_null()) return false;
+            if (node.value("type", std::string()) == type) return true;
+            for (const char* list : {"normalizers", "pretokenizers"}) {
+                if (node.contains(list)) {
+                    for (const auto& child : node[list]) if (child.value("type", std::string()) == type) return true;
+                }
+            }
+            return false;
+        };
+        PreTokenizer pre_tokenizer = PreTokenizer::NONE;
+        if (j.contains("normalizer") && has_type(j["normalizer"], "Lowercase")) header.flags |= LOWERCASE;
+        if (j.contains("pre_tokenizer")) {
+            const nlohmann::json& pre = j["pre_tokenizer"];
+            if (has_type(pre, "ByteLevel")) {
+                pre_tokenizer = PreTokenizer::BYTE_LEVEL;
+                const nlohmann::json* byte_level = &pre;
+                if (pre.contains("pretokenizers")) {
+                    for (const auto& child : pre["pretokenizers"]) if (child.value("type", std::string()) == "ByteLevel") byte_level = &child;
+                }
+                if (byte_level->value("add_prefix_space", false)) header.flags |= ADD_PREFIX_SPACE;
+            } else if (has_type(pre, "Whitespace")) {
+                pre_tokenizer = PreTokenizer::WHITESPACE;
+            } else if (has_type(pre, "WhitespaceSplit")) {
+                pre_tokenizer = PreTokenizer::WHITESPACE_SPLIT;
+            }
+        }
+        header.pre_tokenizer = static_cast<uint32_t>(pre_tokenizer);
+
+        std::string symbol;
+        for (uint32_t b = 0; b < 256; ++b) {
+            symbol.clear();
+            append_utf8(symbol, byte_level_codepoint(b));
+            byte_ids[b] = id_of(symbol);
+        }
+
+        const nlohmann::json& merges = model["merges"];
+        size_t table_size = 16;
+        while (table_size < merges.size() * 2) table_size <<= 1;
+        table.assign(table_size, MergeSlot{EMPTY_PAIR, 0, 0});
+        uint32_t rank = 0;
+        std::string left, right, merged;
+        for (const auto& m : merges) {
+            if (m.is_string()) {
+                const std::string& s = m.get_ref<const std::string&>();
+                size_t space = s.find(' ');
+                if (space == std::string::npos) { ++rank; continue; }
+                left = s.substr(0, space);
+                right = s.substr(space + 1);
+            } else {
+                left = m[0].get<std::string>();
+                right = m[1].get<std::string>();
+            }
+            merged = left;
+            if (!prefix.empty() && right.compare(0, prefix.size(), prefix) == 0) {
+                merged.append(right, prefix.size(), std::string::npos);
+            } else {
+                merged += right;
+            }
+            uint32_t l = id_of(left), r = id_of(right), id = id_of(merged);
+            if (l != NO_TOKEN && r != NO_TOKEN && id != NO_TOKEN) insert_merge(table, l, r, rank, id);
+            ++rank;
+        }
+        header.num_merges = rank;
+    }
+
+    header.num_added = static_cast<uint32_t>(added.size());
+    header.merge_table_size = table.size();
+    header.prefix_size = static_cast<uint32_t>(prefix.size());
+    header.suffix_size = static_cast<uint32_t>(suffix.size());
+    header.added_pool_size = static_cast<uint32_t>(added_pool.size());
+
+    replace_file(outPath, [&](std::ofstream& out) {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), sizeof(MergeSlot) * table.size());
+        out.write(reinterpret_cast<const char*>(byte_ids), sizeof(byte_ids));
+        out.write(reinterpret_cast<const char*>(added.data()), sizeof(AddedTokenRecord) * added.size());
+        out << prefix << suffix << added_pool;
+    });
+    if (bpe) std::cout << "Compiled BPE tokenizer to " << outPath << ": " << header.num_merges << " merges, " << added.size() << " added tokens." << std::endl;
+    return bpe;
+}
+
+bool BpeEncoder::open(const std::string& path, const CompiledVocab& compiled_vocab) {
+    loaded = false;
+    header = nullptr;
+    added_tokens.clear();
+    unicode_to_byte.clear();
+    std::fill(added_first_bytes, added_first_bytes + 8, 0u);
+
+    file.open(path);
+    if (file.size() < sizeof(BpeFileHeader)) throw std::runtime_error("BPE file too small: " + path);
+    const BpeFileHeader* h = reinterpret_cast<const BpeFileHeader*>(file.data());
+    if (std::memcmp(h->magic, "FMMBPE\0\0", 8) != 0 || h->version != FORMAT_VERSION) {
+        throw std::runtime_error("not a compiled BPE tokenizer (or wrong version): " + path);
+    }
+    size_t expected = sizeof(BpeFileHeader) + sizeof(MergeSlot) * h->merge_table_size + sizeof(uint32_t) * 256 +
+                      sizeof(AddedTokenRecord) * h->num_added + h->prefix_size + h->suffix_size + h->added_pool_size;
+    if (file.size() < expected) throw std::runtime_error("truncated BPE file: " + path);
+    if (!(h->flags & HAS_MODEL)) return false;
+    if (h->merge_table_size == 0 || (h->merge_table_size & (h->merge_table_size - 1)) != 0) {
+        throw std::runtime_error("bad merge table in " + path);
+    }
+
+    header = h;
+    vocab = &compiled_vocab;
+    pre_tokenizer = static_cast<PreTokenizer>(h->pre_tokenizer);
+    add_prefix_space = (h->flags & ADD_PREFIX_SPACE) != 0;
+    lowercase = (h->flags & LOWERCASE) != 0;
+    unk_id = h->unk_id;
+
+    const char* p = file.data() + sizeof(BpeFileHeader);
+    merge_table = reinterpret_cast<const MergeSlot*>(p);
+    merge_mask = static_cast<size_t>(h->merge_table_size) - 1;
+    p += sizeof(MergeSlot) * h->merge_table_size;
+    byte_level_ids = reinterpret_cast<const uint32_t*>(p);
+    p += sizeof(uint32_t) * 256;
+    const AddedTokenRecord* added = reinterpret_cast<const AddedTokenRecord*>(p);
+    p += sizeof(AddedTokenRecord) * h->num_added;
+    continuing_subword_prefix = std::string_view(p, h->prefix_size);
+    p += h->prefix_size;
+    end_of_word_suffix = std::string_view(p, h->suffix_size);
+    p += h->suffix_size;
+    for (uint32_t i = 0; i < h->num_added; ++i) {
+        if (static_cast<uint64_t>(added[i].offset) + added[i].length > h->added_pool_size) throw std::runtime_error("bad added token in " + path);
+        added_tokens.push_back({std::string_view(p + added[i].offset, added[i].length), added[i].id});
+        unsigned char first = static_cast<unsigned char>(p[added[i].offset]);
+        added_first_bytes[first >> 5] |= 1u << (first & 31);
+    }
+
+    for (uint32_t b = 0; b < 256; ++b) unicode_to_byte[byte_level_codepoint(b)] = static_cast<uint8_t>(b);
+
+    loaded = true;
+    std::cout << "BPE tokenizer loaded: " << vocab->size() << " tokens, " << h->num_merges << " merges." << std::endl;
+    return true;
+}
+
+void BpeEncoder::merge_word(std::string_view word, BpeWorkspace& ws) const {
+    auto& symbols = ws.symbols;
+    auto& heap = ws.heap;
+    symbols.clear();
+    heap.clear();
+
+    auto add_symbol = [&](uint32_t id) {
+        int idx = static_cast<int>(symbols.size());
+        symbols.push_back({id, idx - 1, -1});
+        if (idx > 0) symbols[idx - 1].next = idx;
+    };
+    if (pre_tokenizer == PreTokenizer::BYTE_LEVEL) {
+        for (unsigned char b : word) {
+            if (byte_level_ids[b] != NO_TOKEN) add_symbol(byte_level_ids[b]);
+            else if (unk_id != NO_TOKEN) add_symbol(unk_id);
+        }
+    } else {
+        for (size_t i = 0; i < word.size();) {
+            size_t len = std::min(utf8_length(static_cast<unsigned char>(word[i])), word.size() - i);
+            ws.piece.clear();
+            if (i > 0) ws.piece += continuing_subword_prefix;
+            ws.piece.append(word.data() + i, len);
+            if (i + len == word.size()) ws.piece += end_of_word_suffix;
+            uint32_t id = lookup(ws.piece);
+            if (id != NO_TOKEN) add_symbol(id);
+            else if (unk_id != NO_TOKEN) add_symbol(unk_id);
+            i += len;
+        }
+    }
+
+    auto push_pair = [&](int left) {
+        int right = symbols[left].next;
+        if (right < 0) return;
+        const MergeSlot* m = find_merge(symbols[left].id, symbols[right].id);
+        if (!m) return;
+        heap.push_back({m->rank, left, symbols[left].id, symbols[right].id, m->merged_id});
+        std::push_heap(heap.begin(), heap.end(), CandidateAfter());
+    };
+    for (int i = 0; i + 1 < static_cast<int>(symbols.size()); ++i) push_pair(i);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), CandidateAfter());
+        BpeWorkspace::Candidate c = heap.back();
+        heap.pop_back();
+        BpeWorkspace::Symbol& l = symbols[c.left];
+        // Skip candidates invalidated by an earlier merge on either side.
+        if (l.id != c.left_id || l.next < 0 || symbols[l.next].id != c.right_id) continue;
+        int r = l.next;
+        l.id = c.merged_id;
+        l.next = symbols[r].next;
+        if (l.next >= 0) symbols[l.next].prev = c.left;
+        symbols[r].id = NO_TOKEN;
+        if (l.prev >= 0) push_pair(l.prev);
+        push_pair(c.left);
+    }
+
+    ws.word_ids.clear();
+    for (int i = symbols.empty() ? -1 : 0; i >= 0; i = symbols[i].next) ws.word_ids.push_back(symbols[i].id);
+}
+
+void BpeEncoder::encode_word(std::string_view word, std::vector<uint32_t>& out, BpeWorkspace& ws) const {
+    if (word.empty()) return;
+    if (const std::vector<uint32_t>* cached = ws.cache_find(word)) {
+        out.insert(out.end(), cached->begin(), cached->end());
+        return;
+    }
+    merge_word(word, ws);
+    ws.cache_insert(word, ws.word_ids);
+    out.insert(out.end(), ws.word_ids.begin(), ws.word_ids.end());
+}
+
+void BpeEncoder::encode_segment(std::string_view segment, std::vector<uint32_t>& out, BpeWorkspace& ws) const {
+    if (segment.empty()) return;
+    if (lowercase || (add_prefix_space && pre_tokenizer == PreTokenizer::BYTE_LEVEL && !is_space(segment[0]))) {
+        ws.normalized.clear();
+        if (add_prefix_space && pre_tokenizer == PreTokenizer::BYTE_LEVEL && !is_space(segment[0])) ws.normalized += ' ';
+        ws.normalized.append(segment.data(), segment.size());
+        if (lowercase) for (char& c : ws.normalized) if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        segment = ws.normalized;
+    }
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(segment.data());
+    const size_t n = segment.size();
+
+    switch (pre_tokenizer) {
+        case PreTokenizer::NONE:
+            encode_word(segment, out, ws);
+            break;
+        case PreTokenizer::WHITESPACE_SPLIT:
+            for (size_t i = 0; i < n;) {
+                while (i < n && is_space(s[i])) ++i;
+                size_t start = i;
+                while (i < n && !is_space(s[i])) ++i;
+                encode_word(segment.substr(start, i - start), out, ws);
+            }
+            break;
+        case PreTokenizer::WHITESPACE: // \w+|[^\w\s]+
+            for (size_t i = 0; i < n;) {
+                if (is_space(s[i])) { ++i; continue; }
+                size_t start = i;
+                bool word = is_word(s[i]);
+                while (i < n && !is_space(s[i]) && is_word(s[i]) == word) ++i;
+                encode_word(segment.substr(start, i - start), out, ws);
+            }
+            break;
+        case PreTokenizer::BYTE_LEVEL: // 's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+            for (size_t i = 0; i < n;) {
+                size_t start = i;
+                if (s[i] == '\'' && i + 1 < n) {
+                    unsigned char c1 = s[i + 1], c2 = i + 2 < n ? s[i + 2] : 0;
+                    size_t len = 0;
+                    if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd') len = 2;
+                    else if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l')) len = 3;
+                    if (len) {
+                        encode_word(segment.substr(i, len), out, ws);
+                        i += len;
+                        continue;
+                    }
+                }
+                size_t j = (s[i] == ' ' && i + 1 < n && !is_space(s[i + 1])) ? i + 1 : i;
+                if (!is_space(s[j])) {
+                    if (is_letter(s[j])) { while (j < n && is_letter(s[j])) ++j; }
+                    else if (is_digit(s[j])) { while (j < n && is_digit(s[j])) ++j; }
+                    else { while (j < n && !is_space(s[j]) && !is_letter(s[j]) && !is_digit(s[j])) ++j; }
+                    i = j;
+                } else {
+                    while (j < n && is_space(s[j])) ++j;
+                    // Leave the last space of a run to prefix the following word.
+                    i = (j < n && j - start > 1) ? j - 1 : j;
+                }
+                encode_word(segment.substr(start, i - start), out, ws);
+            }
+            break;
+    }
+}
+
+void BpeEncoder::encode(std::string_view text, std::vector<uint32_t>& out, BpeWorkspace& ws) const {
+    out.clear();
+    size_t segment_start = 0;
+    if (!added_tokens.empty()) {
+        for (size_t i = 0; i < text.size();) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            const AddedToken* match = nullptr;
+            if (added_first_bytes[c >> 5] & (1u << (c & 31))) {
+                for (const AddedToken& token : added_tokens) {
+                    if (text.compare(i, token.content.size(), token.content) == 0) { match = &token; break; }
+                }
+            }
+            if (!match) { ++i; continue; }
+            encode_segment(text.substr(segment_start, i - segment_start), out, ws);
+            out.push_back(match->id);
+            i += match->content.size();
+            segment_start = i;
+        }
+    }
+    encode_segment(text.substr(segment_start), out, ws);
+}
+
+void BpeEncoder::decode(uint32_t id, std::string& out) const {
+    std::string_view token = vocab ? vocab->token(id) : std::string_view();
+    if (token.empty()) return;
+    if (pre_tokenizer == PreTokenizer::BYTE_LEVEL) {
+        for (size_t i = 0; i < token.size();) {
+            size_t len = std::min(utf8_length(static_cast<unsigned char>(token[i])), token.size() - i);
+            auto it = unicode_to_byte.find(decode_utf8(token.data() + i, len));
+            if (it != unicode_to_byte.end()) out += static_cast<char>(it->second);
+            else out.append(token.data() + i, len);
+            i += len;
+        }
+    } else if (!end_of_word_suffix.empty() && token.size() >= end_of_word_suffix.size() &&
+               token.compare(token.size() - end_of_word_suffix.size(), end_of_word_suffix.size(), end_of_word_suffix) == 0) {
+        out.append(token.data(), token.size() - end_of_word_suffix.size());
+        out += ' ';
+    } else if (!continuing_subword_prefix.empty() && token.compare(0, continuing_subword_prefix.size(), continuing_subword_prefix) == 0) {
+        out.append(token.data() + continuing_subword_prefix.size(), token.size() - continuing_subword_prefix.size());
+    } else if (end_of_word_suffix.empty()) {
+        out += ' ';
+        out.append(token.data(), token.size());
+    } else {
+        out.append(token.data(), token.size());
+    }
+}
@@ -0,0 +1,171 @@
+// src/bpe.hpp (Native BPE encoder for HuggingFace tokenizer.json models)
+
+#ifndef FMM_BPE_HPP
+#define FMM_BPE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "mapped_file.hpp"
+#include "vocab.hpp"
+
+// Mutable per-caller state for BpeEncoder::encode: an LRU cache of pre-tokenized words and
+// the scratch buffers of the merge loop. One workspace per thread; the encoder is shared.
+class BpeWorkspace {
+public:
+    explicit BpeWorkspace(size_t cache_capacity = 1 << 16);
+
+    size_t cache_hits() const { return hits; }
+    size_t cache_misses() const { return misses; }
+
+private:
+    friend class BpeEncoder;
+
+    struct Symbol {
+        uint32_t id;
+        int prev;
+        int next;
+    };
+    struct Candidate {
+        uint32_t rank;
+        int left;
+        uint32_t left_id;
+        uint32_t right_id;
+        uint32_t merged_id;
+    };
+    struct CacheEntry {
+        std::string word;
+        std::vector<uint32_t> ids;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    const std::vector<uint32_t>* cache_find(std::string_view word);
+    void cache_insert(std::string_view word, const std::vector<uint32_t>& ids);
+    void cache_touch(uint32_t idx);
+    void cache_unlink(uint32_t idx);
+
+    static constexpr uint32_t NIL = UINT32_MAX;
+    size_t capacity;
+    std::vector<CacheEntry> entries;
+    std::unordered_map<std::string, uint32_t> index;
+    uint32_t head = NIL; // most recently used
+    uint32_t tail = NIL; // least recently used
+    std::string key;     // reused lookup key, so probing the cache does not allocate
+    size_t hits = 0;
+    size_t misses = 0;
+
+    std::vector<Symbol> symbols;
+    std::vector<Candidate> heap;
+    std::vector<uint32_t> word_ids;
+    std::string piece;
+    std::string normalized;
+};
+
+// On-disk layout of bpe.bin, compiled from tokenizer.json next to vocab.bin (native-endian,
+// 8-byte aligned). Token strings are not repeated here: the encoder resolves them through
+// the CompiledVocab of the same tokenizer.
+//   BpeFileHeader
+//   MergeSlot merge_table[merge_table_size]  open addressing on (left, right), power-of-two size
+//   uint32_t  byte_level_ids[256]            id of each byte's single-char token (ByteLevel)
+//   AddedTokenRecord added[num_added]        longest content first
+//   char      continuing_subword_prefix[prefix_size], end_of_word_suffix[suffix_size],
+//             added token contents[added_pool_size]
+struct BpeFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;         // BpeEncoder::HAS_MODEL, ADD_PREFIX_SPACE, LOWERCASE
+    uint32_t pre_tokenizer;
+    uint32_t unk_id;
+    uint32_t num_merges;
+    uint32_t num_added;
+    uint64_t merge_table_size;
+    uint32_t prefix_size;
+    uint32_t suffix_size;
+    uint32_t added_pool_size;
+    uint32_t reserved;
+};
+
+// Immutable after open(); encode() is const and safe to call from many threads as long as
+// each uses its own BpeWorkspace.
+class BpeEncoder {
+public:
+    static constexpr uint32_t NO_TOKEN = UINT32_MAX;
+    static constexpr uint32_t FORMAT_VERSION = 1;
+    static constexpr uint32_t HAS_MODEL = 1, ADD_PREFIX_SPACE = 2, LOWERCASE = 4;
+
+    BpeEncoder() = default;
+
+    // Compiles the merges, added tokens, pre-tokenizer and decoder settings of a HuggingFace
+    // tokenizer.json into bpe.bin. A tokenizer whose model is not BPE compiles to a file that
+    // says so, and returns false; the engine then tokenizes by words without re-reading
+    // the JSON on every start.
+    static bool compile(const std::string& tokenizerPath, const std::string& outPath);
+
+    // Maps a compiled bpe.bin. Token strings and ids come from `vocab`, compiled from the same
+    // tokenizer.json, which must outlive the encoder. Returns false, leaving the encoder
+    // unloaded, when the file holds no BPE model; throws when it is not a bpe.bin.
+    bool open(const std::string& path, const CompiledVocab& vocab);
+
+    bool is_loaded() const { return loaded; }
+
+    // Replaces the contents of `out` with the ids of `text`.
+    void encode(std::string_view text, std::vector<uint32_t>& out, BpeWorkspace& ws) const;
+
+    // Appends the surface text of one token to `out`.
+    void decode(uint32_t id, std::string& out) const;
+
+    uint32_t token_to_id(std::string_view token) const { return lookup(token); }
+    size_t num_merges() const { return header ? header->num_merges : 0; }
+
+private:
+    enum class PreTokenizer { NONE, WHITESPACE, WHITESPACE_SPLIT, BYTE_LEVEL };
+
+    struct MergeSlot {
+        uint64_t pair;   // (left_id << 32) | right_id, EMPTY_PAIR when unused
+        uint32_t rank;
+        uint32_t merged_id;
+    };
+    static constexpr uint64_t EMPTY_PAIR = UINT64_MAX;
+
+    struct AddedTokenRecord {
+        uint32_t id;
+        uint32_t offset; // into the added token pool
+        uint32_t length;
+    };
+    struct AddedToken {
+        std::string_view content;
+        uint32_t id;
+    };
+
+    static void insert_merge(std::vector<MergeSlot>& table, uint32_t left, uint32_t right, uint32_t rank, uint32_t merged);
+    const MergeSlot* find_merge(uint32_t left, uint32_t right) const;
+
+    void encode_segment(std::string_view segment, std::vector<uint32_t>& out, BpeWorkspace& ws) const;
+    void encode_word(std::string_view word, std::vector<uint32_t>& out, BpeWorkspace& ws) const;
+    void merge_word(std::string_view word, BpeWorkspace& ws) const;
+    uint32_t lookup(std::string_view token) const { return vocab ? vocab->lookup(token) : NO_TOKEN; }
+
+    bool loaded = false;
+    MappedFile file;
+    const BpeFileHeader* header = nullptr;
+    const CompiledVocab* vocab = nullptr;
+    PreTokenizer pre_tokenizer = PreTokenizer::NONE;
+    bool add_prefix_space = false;
+    bool lowercase = false;
+    std::string_view continuing_subword_prefix;
+    std::string_view end_of_word_suffix;
+    uint32_t unk_id = NO_TOKEN;
+
+    const MergeSlot* merge_table = nullptr; // mapped from the file
+    size_t merge_mask = 0;
+    const uint32_t* byte_level_ids = nullptr;
+    std::vector<AddedToken> added_tokens;   // views into the file
+    uint32_t added_first_bytes[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // bitset of added tokens' first bytes
+
+    std::unordered_map<uint32_t, uint8_t> unicode_to_byte; // ByteLevel alphabet, for decode
+};
+
+#endif // FMM_BPE_HPP
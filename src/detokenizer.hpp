@@ -0,0 +1,63 @@
+// src/detokenizer.hpp (Surface text of every token, decoded once into a flat pool)
+
+#ifndef FMM_DETOKENIZER_HPP
+#define FMM_DETOKENIZER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+// Byte-level BPE decoding maps every character of a token through a table; done per generated
+// token, it also builds a string each time. The detokenizer does it once per vocabulary entry
+// at startup, so turning ids into text is a lookup and a memcpy into the caller's buffer.
+class Detokenizer {
+public:
+    // text_of(id, out) appends the surface text of `id` to `out`, for every id below num_ids.
+    template<typename F>
+    void build(size_t num_ids, F&& text_of) {
+        pool.clear();
+        offsets.assign(1, 0);
+        offsets.reserve(num_ids + 1);
+        std::string text;
+        for (size_t id = 0; id < num_ids; ++id) {
+            text.clear();
+            text_of(static_cast<uint32_t>(id), text);
+            pool.insert(pool.end(), text.begin(), text.end());
+            if (pool.size() > UINT32_MAX) throw std::runtime_error("token text does not fit the detokenizer pool");
+            offsets.push_back(static_cast<uint32_t>(pool.size()));
+        }
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+
+    // Empty for ids outside the vocabulary. Valid for the detokenizer's lifetime.
+    std::string_view text(uint32_t id) const {
+        if (static_cast<size_t>(id) + 1 >= offsets.size()) return std::string_view();
+        return std::string_view(pool.data() + offsets[id], offsets[id + 1] - offsets[id]);
+    }
+
+    // Writes the text of ids[0..n) to buf, whole tokens only: stops before the first token that
+    // would overrun `capacity`. Returns the bytes written (no terminator); *consumed, if given,
+    // receives the number of ids written, so a caller can flush and continue from there.
+    size_t decode(const uint32_t* ids, size_t n, char* buf, size_t capacity, size_t* consumed = nullptr) const {
+        size_t written = 0, i = 0;
+        for (; i < n; ++i) {
+            std::string_view token = text(ids[i]);
+            if (token.size() > capacity - written) break;
+            std::memcpy(buf + written, token.data(), token.size());
+            written += token.size();
+        }
+        if (consumed) *consumed = i;
+        return written;
+    }
+
+private:
+    std::vector<char> pool;
+    std::vector<uint32_t> offsets{0}; // text(id) is pool[offsets[id], offsets[id + 1])
+};
+
+#endif // FMM_DETOKENIZER_HPP
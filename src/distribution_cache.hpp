@@ -0,0 +1,201 @@
+// src/distribution_cache.hpp (Byte-budgeted CLOCK cache of decoded distributions for hot tokens)
+
+#ifndef FMM_DISTRIBUTION_CACHE_HPP
+#define FMM_DISTRIBUTION_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include "utils.hpp"
+#include "mapped_file.hpp"
+
+// A distribution copied out of the LMDB map. Shared, so a step that is still reading one keeps
+// it alive even if another thread evicts it meanwhile.
+using CachedEntries = std::shared_ptr<const std::vector<ProbEntry>>;
+
+// Sharded CLOCK cache from (table, token id) to a decoded distribution, bounded by bytes rather
+// than entries because distribution sizes follow token frequency. Safe to share between
+// threads; each shard has its own lock. A hit skips the B-tree descent and any page fault on
+// a cold map.
+class DistributionCache {
+public:
+    static constexpr size_t NUM_SHARDS = 16;
+    // Bookkeeping per entry on top of its ProbEntry array: the Entry, its index node and the
+    // shared_ptr control block, roughly.
+    static constexpr size_t ENTRY_OVERHEAD = 96;
+
+    enum Table : uint32_t { NEXT = 0, PREV = 1 };
+
+    static uint64_t key_of(Table table, uint32_t token_id) { return (static_cast<uint64_t>(table) << 32) | token_id; }
+    static Table table_of(uint64_t key) { return static_cast<Table>(key >> 32); }
+    static uint32_t token_of(uint64_t key) { return static_cast<uint32_t>(key); }
+
+    // budget_bytes 0 disables the cache. Drops everything cached so far.
+    void configure(size_t budget_bytes) {
+        std::unique_ptr<Shard[]> fresh(budget_bytes > 0 ? new Shard[NUM_SHARDS] : nullptr);
+        for (size_t i = 0; fresh && i < NUM_SHARDS; ++i) fresh[i].budget = budget_bytes / NUM_SHARDS;
+        shards.swap(fresh);
+        hit_count = 0;
+        miss_count = 0;
+    }
+
+    bool enabled() const { return shards != nullptr; }
+
+    CachedEntries find(uint64_t key) {
+        Shard& shard = shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            miss_count.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Entry& entry = shard.entries[it->second];
+        entry.referenced = true;
+        hit_count.fetch_add(1, std::memory_order_relaxed);
+        return entry.value;
+    }
+
+    // Copies `n` entries in. With `evict` false (preloading) nothing already cached is pushed
+    // out: returns false once the shard is full, and leaves the cache unchanged.
+    bool insert(uint64_t key, const ProbEntry* entries, size_t n, bool evict = true) {
+        size_t bytes = n * sizeof(ProbEntry) + ENTRY_OVERHEAD;
+        Shard& shard = shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (bytes > shard.budget || shard.index.count(key)) return false;
+        if (!evict && shard.used + bytes > shard.budget) return false;
+        while (shard.used + bytes > shard.budget) {
+            // CLOCK: skip (and clear) recently used entries, evict the first cold one.
+            while (shard.entries[shard.hand].referenced) {
+                shard.entries[shard.hand].referenced = false;
+                shard.hand = (shard.hand + 1) % shard.entries.size();
+            }
+            shard.remove(shard.hand);
+            if (shard.hand >= shard.entries.size()) shard.hand = 0;
+        }
+        shard.index[key] = static_cast<uint32_t>(shard.entries.size());
+        shard.entries.push_back(Entry{key, std::make_shared<const std::vector<ProbEntry>>(entries, entries + n), bytes, false});
+        shard.used += bytes;
+        return true;
+    }
+
+    // Every cached key, the recently used ones of each shard first, for saving a warm set.
+    std::vector<uint64_t> keys() const {
+        std::vector<uint64_t> hot, cold;
+        for (size_t i = 0; shards && i < NUM_SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            for (const Entry& entry : shards[i].entries) (entry.referenced ? hot : cold).push_back(entry.key);
+        }
+        hot.insert(hot.end(), cold.begin(), cold.end());
+        return hot;
+    }
+
+    size_t bytes() const {
+        size_t total = 0;
+        for (size_t i = 0; shards && i < NUM_SHARDS; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            total += shards[i].used;
+        }
+        return total;
+    }
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+    double hit_rate() const {
+        uint64_t total = hits() + misses();
+        return total ? static_cast<double>(hits()) / total : 0.0;
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        CachedEntries value;
+        size_t bytes;
+        bool referenced;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<Entry> entries;
+        std::unordered_map<uint64_t, uint32_t> index;
+        size_t hand = 0;
+        size_t budget = 0;
+        size_t used = 0;
+
+        // Moves the last entry into slot i.
+        void remove(size_t i) {
+            used -= entries[i].bytes;
+            index.erase(entries[i].key);
+            if (i + 1 != entries.size()) {
+                entries[i] = std::move(entries.back());
+                index[entries[i].key] = static_cast<uint32_t>(i);
+            }
+            entries.pop_back();
+        }
+    };
+
+    static size_t shard_of(uint64_t key) { return (key ^ (key >> 32)) % NUM_SHARDS; }
+
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+};
+
+// A list of cache keys on disk: the trainer's hottest tokens (hot_tokens.bin) or the set an
+// engine had cached at shutdown (its warm set, if it was given a path for one). Only keys are stored; the values
+// are re-read from LMDB, so a saved set never goes stale against the model.
+//   char magic[8] "FMMCKEYS", uint32_t version, uint32_t reserved, uint64_t count,
+//   uint64_t keys[count]   DistributionCache::key_of, most valuable first
+namespace cache_key_file {
+
+const uint32_t FORMAT_VERSION = 1;
+
+inline void write(const std::string& outPath, const std::vector<uint64_t>& keys) {
+    char header[24];
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header, "FMMCKEYS", 8);
+    std::memcpy(header + 8, &FORMAT_VERSION, sizeof(uint32_t));
+    uint64_t count = keys.size();
+    std::memcpy(header + 16, &count, sizeof(uint64_t));
+
+    replace_file(outPath, [&](std::ofstream& out) {
+        out.write(header, sizeof(header));
+        out.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint64_t));
+    });
+}
+
+// Empty when the file is missing; throws when it exists but is not a key list.
+inline std::vector<uint64_t> read(const std::string& path) {
+    std::vector<uint64_t> keys;
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return keys;
+    char header[24];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    if (!in.read(header, sizeof(header)) || std::memcmp(header, "FMMCKEYS", 8) != 0) {
+        throw std::runtime_error("not a cache key list: " + path);
+    }
+    std::memcpy(&version, header + 8, sizeof(uint32_t));
+    std::memcpy(&count, header + 16, sizeof(uint64_t));
+    if (version != FORMAT_VERSION) throw std::runtime_error("wrong cache key list version: " + path);
+    // Bound the count by what the file holds before allocating for it.
+    std::streampos keys_begin = in.tellg();
+    in.seekg(0, std::ios::end);
+    uint64_t available = static_cast<uint64_t>(in.tellg() - keys_begin) / sizeof(uint64_t);
+    in.seekg(keys_begin);
+    if (count > available) throw std::runtime_error("truncated cache key list: " + path);
+    keys.resize(count);
+    if (!in.read(reinterpret_cast<char*>(keys.data()), count * sizeof(uint64_t))) throw std::runtime_error("truncated cache key list: " + path);
+    return keys;
+}
+
+} // namespace cache_key_file
+
+#endif // FMM_DISTRIBUTION_CACHE_HPP
@@ -0,0 +1,171 @@
+// src/distributions.hpp (Zero-copy views of the p_next / p_prev tables)
+
+#ifndef FMM_DISTRIBUTIONS_HPP
+#define FMM_DISTRIBUTIONS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "lmdb++.h"
+#include "utils.hpp"
+#include "key_bitmap.hpp"
+#include "distribution_cache.hpp"
+#include "metrics.hpp"
+
+// A distribution as stored by the trainer: an array of ProbEntry inside the LMDB map.
+// Valid for as long as the read transaction it was fetched under.
+struct Distribution {
+    const ProbEntry* entries = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+
+    float prob_of(uint32_t target_id) const {
+        for (size_t i = 0; i < size; ++i) if (entries[i].token_id == target_id) return entries[i].probability;
+        return 0.0f;
+    }
+};
+
+inline Distribution fetch_distribution(MDB_txn* txn, MDB_dbi dbi, uint32_t token_id) {
+    lmdb::val key(token_id);
+    MDB_val data;
+    metrics::add(metrics::LMDB_READS);
+    if (mdb_get(txn, dbi, &key.mdb_val, &data) != 0) {
+        metrics::add(metrics::LMDB_MISSES);
+        return Distribution();
+    }
+    return Distribution{static_cast<const ProbEntry*>(data.mv_data), data.mv_size / sizeof(ProbEntry)};
+}
+
+// Distributions for a set of keys fetched up front, so that many contexts (or threads)
+// needing the same token share one lookup. Keys are kept sorted for binary search.
+// Each table is read in one cursor sweep in key order. Adjacent token ids are a single
+// MDB_NEXT step on the same or the next leaf page. Only gaps cost a B-tree descent
+// (MDB_SET_RANGE), and those still run front to back through the file. With a
+// DistributionCache, cached keys skip the sweep, and what the sweep finds is cached.
+class PrefetchedDistributions {
+public:
+    void clear() {
+        next.clear();
+        prev.clear();
+    }
+
+    // Key lists may contain duplicates and need not be sorted; they are sorted in place.
+    // With `present`, keys a table has no entry for are dropped before the sweep.
+    void fetch(MDB_txn* txn, MDB_dbi next_dbi, MDB_dbi prev_dbi, std::vector<uint32_t>& next_keys, std::vector<uint32_t>& prev_keys,
+               const DistributionKeys* present = nullptr, DistributionCache* cache = nullptr) {
+        if (present) {
+            present->drop_missing_next(next_keys);
+            present->drop_missing_prev(prev_keys);
+        }
+        if (cache && !cache->enabled()) cache = nullptr;
+        next.fetch(txn, next_dbi, next_keys, cache, DistributionCache::NEXT);
+        prev.fetch(txn, prev_dbi, prev_keys, cache, DistributionCache::PREV);
+    }
+
+    size_t size() const { return next.keys.size() + prev.keys.size(); }
+
+    const Distribution* find_next(uint32_t token_id) const { return next.find(token_id); }
+    const Distribution* find_prev(uint32_t token_id) const { return prev.find(token_id); }
+
+private:
+    struct Table {
+        std::vector<uint32_t> keys;
+        std::vector<Distribution> dists;
+        std::vector<CachedEntries> pins; // keeps cache hits alive while dists point into them
+        std::vector<size_t> uncached;    // indexes of the keys the sweep has to read
+
+        void clear() {
+            keys.clear();
+            dists.clear();
+            pins.clear();
+        }
+
+        void fetch(MDB_txn* txn, MDB_dbi dbi, std::vector<uint32_t>& wanted, DistributionCache* cache, DistributionCache::Table table) {
+            std::sort(wanted.begin(), wanted.end());
+            wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+            keys = wanted;
+            dists.assign(keys.size(), Distribution());
+            pins.clear();
+            uncached.clear();
+            for (size_t i = 0; i < keys.size(); ++i) {
+                CachedEntries hit = cache ? cache->find(DistributionCache::key_of(table, keys[i])) : nullptr;
+                if (!hit) {
+                    uncached.push_back(i);
+                    continue;
+                }
+                dists[i] = Distribution{hit->data(), hit->size()};
+                pins.push_back(std::move(hit));
+            }
+            if (uncached.empty()) return;
+
+            lmdb::cursor cursor(txn, dbi);
+            MDB_val key, data;
+            bool positioned = false;
+            uint32_t at = 0; // the cursor's key, whose value is in `data`
+            size_t found_count = 0;
+            for (size_t i : uncached) {
+                uint32_t want = keys[i];
+                if (!positioned || at < want) {
+                    bool found;
+                    if (positioned && at + 1 == want) {
+                        found = cursor.get(key, data, MDB_NEXT);
+                    } else {
+                        key = lmdb::val(want).mdb_val;
+                        found = cursor.get(key, data, MDB_SET_RANGE);
+                    }
+                    if (!found) break; // past the last key: none of the rest exist
+                    positioned = true;
+                    std::memcpy(&at, key.mv_data, sizeof(at));
+                }
+                // at > want: the table has no entry for `want` and the cursor already sits on a later key.
+                if (at != want) continue;
+                dists[i] = Distribution{static_cast<const ProbEntry*>(data.mv_data), data.mv_size / sizeof(ProbEntry)};
+                if (cache) cache->insert(DistributionCache::key_of(table, want), dists[i].entries, dists[i].size);
+                found_count++;
+            }
+            metrics::add(metrics::LMDB_READS, uncached.size());
+            metrics::add(metrics::LMDB_MISSES, uncached.size() - found_count);
+        }
+
+        const Distribution* find(uint32_t token_id) const {
+            auto it = std::lower_bound(keys.begin(), keys.end(), token_id);
+            if (it == keys.end() || *it != token_id) return nullptr;
+            return &dists[it - keys.begin()];
+        }
+    };
+
+    Table next;
+    Table prev;
+};
+
+// Where one prediction reads its distributions from: straight from LMDB under `txn`, or
+// from a prefetched table with LMDB as the fallback for keys it does not hold. Ids the key
+// bitmap rules out are answered empty without touching either.
+struct DistributionSource {
+    MDB_txn* txn = nullptr;
+    MDB_dbi next_dbi = 0;
+    MDB_dbi prev_dbi = 0;
+    const PrefetchedDistributions* prefetched = nullptr;
+    const DistributionKeys* keys = nullptr;
+
+    Distribution next(uint32_t token_id) const {
+        if (keys && !keys->has_next(token_id)) return Distribution();
+        if (prefetched) {
+            if (const Distribution* d = prefetched->find_next(token_id)) return *d;
+        }
+        return fetch_distribution(txn, next_dbi, token_id);
+    }
+
+    Distribution prev(uint32_t token_id) const {
+        if (keys && !keys->has_prev(token_id)) return Distribution();
+        if (prefetched) {
+            if (const Distribution* d = prefetched->find_prev(token_id)) return *d;
+        }
+        return fetch_distribution(txn, prev_dbi, token_id);
+    }
+};
+
+#endif // FMM_DISTRIBUTIONS_HPP
@@ -0,0 +1,72 @@
+// src/generation.hpp (Options, per-request state and latency stats for streaming generation)
+
+#ifndef FMM_GENERATION_HPP
+#define FMM_GENERATION_HPP
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "prefix_cache.hpp"
+
+enum class StopReason {
+    NONE,            // still running
+    MAX_TOKENS,
+    STOP_TOKEN,      // the model predicted a stop token; it is not emitted
+    NO_PREDICTION,   // empty prompt, no memory match or no confident candidate
+    END_OF_RESPONSE, // a retrieved response ran out without a stop token
+    CANCELLED,       // the token callback returned false
+    ERROR
+};
+
+struct GenerationOptions {
+    uint32_t max_tokens = 80;
+    std::vector<uint32_t> stop_token_ids;
+    bool stop_on_special_tokens = true; // also stop on any bracketed token, e.g. [STOP], or one with no text
+    bool respond = true;                // answer the prompt, as if it ended in [RESPONSE]
+    bool whole_response = false;        // answer with the best memory's stored response in full
+};
+
+struct GenerationStats {
+    uint32_t num_tokens = 0;
+    StopReason stop_reason = StopReason::NONE;
+    double time_to_first_token_ms = 0.0;
+    double mean_inter_token_ms = 0.0;
+    double max_inter_token_ms = 0.0;
+    double total_ms = 0.0;
+};
+
+// One in-flight generation. It owns its token ids (prompt, [RESPONSE], generated tokens),
+// so InferenceEngine::generate_step can advance it with any InferenceContext and tokens
+// are appended as ids instead of re-encoding the growing text every step.
+struct GenerationState {
+    using clock = std::chrono::steady_clock;
+
+    std::vector<uint32_t> ids;
+    bool responding = false;
+    PrefixHandle prefix;                 // shared precomputed start of ids, from the prefix cache
+    const uint32_t* retrieved = nullptr; // whole_response: the memory's response, mapped
+    size_t retrieved_size = 0;
+    size_t retrieved_pos = 0;
+    GenerationOptions options;
+    GenerationStats stats;
+    clock::time_point start;
+    clock::time_point first_token;
+    clock::time_point last_token;
+
+    bool finished() const { return stats.stop_reason != StopReason::NONE; }
+};
+
+inline const char* stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case StopReason::NONE: return "none";
+        case StopReason::MAX_TOKENS: return "max_tokens";
+        case StopReason::STOP_TOKEN: return "stop_token";
+        case StopReason::NO_PREDICTION: return "no_prediction";
+        case StopReason::END_OF_RESPONSE: return "end_of_response";
+        case StopReason::CANCELLED: return "cancelled";
+        case StopReason::ERROR: return "error";
+    }
+    return "unknown";
+}
+
+#endif // FMM_GENERATION_HPP
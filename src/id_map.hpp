@@ -0,0 +1,105 @@
+// src/id_map.hpp (Permutation between tokenizer ids and frequency-ordered model ids)
+
+#ifndef FMM_ID_MAP_HPP
+#define FMM_ID_MAP_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// A model trained with remapping numbers its tokens by corpus frequency, the most frequent
+// getting id 0. Score vectors, LMDB keys and ANN outcomes then cluster their hot entries in
+// a few cache lines and pages. Text only ever meets ids through the tokenizer, so the
+// engine translates there and nowhere else.
+//
+// On-disk layout of id_map.bin (all fields native-endian):
+//   IdMapHeader
+//   uint32_t to_model[num_ids]       tokenizer id -> model id
+//   uint32_t to_tokenizer[num_ids]   model id -> tokenizer id
+// Ids at or above num_ids map to themselves, as does everything without a map.
+struct IdMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_ids;
+};
+
+class IdMap {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    void open(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(IdMapHeader)) throw std::runtime_error("id map too small: " + path);
+        header = reinterpret_cast<const IdMapHeader*>(file.data());
+        if (std::memcmp(header->magic, "FMMIDMAP", 8) != 0 || header->version != FORMAT_VERSION) {
+            throw std::runtime_error("not an id map (or wrong version): " + path);
+        }
+        if (sizeof(IdMapHeader) + 2 * header->num_ids * sizeof(uint32_t) > file.size()) {
+            throw std::runtime_error("truncated id map: " + path);
+        }
+        forward = reinterpret_cast<const uint32_t*>(file.data() + sizeof(IdMapHeader));
+        inverse = forward + header->num_ids;
+    }
+
+    bool is_open() const { return header != nullptr; }
+    uint64_t size() const { return header ? header->num_ids : 0; }
+
+    uint32_t to_model(uint32_t tokenizer_id) const { return tokenizer_id < size() ? forward[tokenizer_id] : tokenizer_id; }
+    uint32_t to_tokenizer(uint32_t model_id) const { return model_id < size() ? inverse[model_id] : model_id; }
+
+    void to_model(std::vector<uint32_t>& ids) const {
+        if (!header) return;
+        for (uint32_t& id : ids) id = to_model(id);
+    }
+
+private:
+    MappedFile file;
+    const IdMapHeader* header = nullptr;
+    const uint32_t* forward = nullptr;
+    const uint32_t* inverse = nullptr;
+};
+
+// Ranks tokenizer ids by how often they occur in the training corpus (ties by id) and
+// writes id_map.bin. counts[id] is the occurrence count of tokenizer id `id`.
+class IdMapWriter {
+public:
+    explicit IdMapWriter(const std::vector<uint64_t>& counts) : forward(counts.size()), inverse(counts.size()) {
+        std::iota(inverse.begin(), inverse.end(), 0u);
+        std::stable_sort(inverse.begin(), inverse.end(), [&](uint32_t a, uint32_t b) { return counts[a] > counts[b]; });
+        for (uint32_t model_id = 0; model_id < inverse.size(); ++model_id) forward[inverse[model_id]] = model_id;
+    }
+
+    uint32_t to_model(uint32_t tokenizer_id) const { return tokenizer_id < forward.size() ? forward[tokenizer_id] : tokenizer_id; }
+
+    void to_model(std::vector<uint32_t>& ids) const {
+        for (uint32_t& id : ids) id = to_model(id);
+    }
+
+    void write(const std::string& outPath) const {
+        IdMapHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "FMMIDMAP", 8);
+        header.version = IdMap::FORMAT_VERSION;
+        header.num_ids = forward.size();
+
+        replace_file(outPath, [&](std::ofstream& out) {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(forward.data()), forward.size() * sizeof(uint32_t));
+            out.write(reinterpret_cast<const char*>(inverse.data()), inverse.size() * sizeof(uint32_t));
+        });
+    }
+
+private:
+    std::vector<uint32_t> forward; // tokenizer id -> model id
+    std::vector<uint32_t> inverse; // model id -> tokenizer id
+};
+
+#endif // FMM_ID_MAP_HPP
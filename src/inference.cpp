@@ -5,36 +5,72 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <random>
 #include <numeric>
 #include <fstream>
 #include <sstream>
+#include <omp.h>
 
 #include "utils.hpp"
+#include "memory_label.hpp"
 #include "nlohmann/json.hpp"
 
-// Helper function to find a probability within a deserialized distribution
-float get_prob(const std::vector<ProbEntry>& dist, uint32_t target_id) {
-    for (const auto& entry : dist) if (entry.token_id == target_id) return entry.probability;
-    return 0.0f;
-}
-
-// THE FIX: The constructor no longer needs the tokenizer path.
-InferenceEngine::InferenceEngine(const std::string& dbPath)
-    : env(dbPath.c_str(), MDB_RDONLY, 0), space(256)
+InferenceEngine::InferenceEngine(const std::string& dbPath, const std::string& tokenizerPath, const std::string& warmSetPath)
+    : env(dbPath.c_str(), MDB_RDONLY | MDB_NOTLS, 0), space(256)
 {
     std::cout << "Initializing Inference Engine..." << std::endl;
     try {
-        // We go back to loading the simple vocab from the DB, which is correct for our word-based trainer.
-        load_vocabulary_from_db();
+        load_vocabulary(dbPath, tokenizerPath);
+        std::string id_map_path = dbPath + "/id_map.bin";
+        if (std::ifstream(id_map_path).is_open()) {
+            id_map.open(id_map_path);
+            if (id_map.size() > vocab.id_space()) throw std::runtime_error("id map is larger than the vocabulary: " + id_map_path);
+            std::cout << "Frequency-ordered token ids (" << id_map.size() << " remapped)." << std::endl;
+        }
+        try {
+            if (!bpe.open(dbPath + "/bpe.bin", vocab)) std::cerr << "Warning: tokenizer model is not BPE, falling back to word tokenization." << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: no BPE encoder (" << e.what() << "), falling back to word tokenization." << std::endl;
+        }
+        response_token_id = vocab.lookup("[RESPONSE]");
+        if (response_token_id != BpeEncoder::NO_TOKEN) response_token_id = id_map.to_model(response_token_id);
+        build_detokenizer();
+        mark_special_tokens();
+        open_tables();
+        std::string responses_path = dbPath + "/responses.bin";
+        if (std::ifstream(responses_path).is_open()) {
+            responses.open(responses_path);
+            std::cout << "Response store mapped: " << responses.size() << " memories." << std::endl;
+        }
+        std::string keys_path = dbPath + "/distribution_keys.bin";
+        if (std::ifstream(keys_path).is_open()) {
+            distribution_keys.open(keys_path);
+            std::cout << "Distribution key bitmap mapped." << std::endl;
+        }
+        hot_tokens_path = dbPath + "/hot_tokens.bin";
+        configure_distribution_cache(DEFAULT_DISTRIBUTION_CACHE_BYTES, warmSetPath);
+        configure_prefix_cache(DEFAULT_PREFIX_CACHE_BYTES);
+        std::string instructions_path = dbPath + "/instructions.bin";
+        if (std::ifstream(instructions_path).is_open()) {
+            instructions.open(instructions_path);
+            std::cout << "Instruction index mapped: " << instructions.size() << " instructions." << std::endl;
+        }
+        init_context(default_context);
         
         std::string index_path = dbPath + "/ann_index.bin";
         std::cout << "Loading ANN index from " << index_path << std::endl;
-        ann_index = new hnswlib::HierarchicalNSW<float>(&space, index_path);
+        // Map the index read-only: no private copy of the graph, and replicas share its pages.
+        ann_index = new hnswlib::HierarchicalNSW<float>(&space);
+        ann_index->loadIndexReadOnly(index_path, &space);
         if (ann_index->getCurrentElementCount() == 0) {
             std::cerr << "Warning: ANN index is empty or could not be loaded." << std::endl;
         }
         std::cout << "ANN index loaded with " << ann_index->getCurrentElementCount() << " vectors." << std::endl;
+        outcome_labels = ann_index->getCurrentElementCount() > 0 && memory_label::is_packed(ann_index->getExternalLabel(0));
+        metrics::add_collector(this, [this](metrics::Snapshot& snap) {
+            snap.counters[metrics::ANN_HOPS] += ann_index->metric_hops.load();
+            snap.counters[metrics::ANN_DISTANCES] += ann_index->metric_distance_computations.load();
+        });
+        retrieval_cache.configure(1 << 16, 0);
     } catch (const std::exception& e) {
         std::cerr << "Fatal Error during initialization: " << e.what() << std::endl;
         exit(1);
@@ -43,160 +79,685 @@ InferenceEngine::InferenceEngine(const std::string& dbPath)
 }
 
 InferenceEngine::~InferenceEngine() {
+    try {
+        save_distribution_cache();
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: could not save the distribution cache: " << e.what() << std::endl;
+    }
+    metrics::remove_collector(this);
     if (ann_index) delete ann_index;
 }
 
-// THE FIX: Renamed this function back to its original, correct purpose.
-void InferenceEngine::load_vocabulary_from_db() {
-    std::cout << "Loading vocabulary from database..." << std::endl;
-    lmdb::txn txn = lmdb::txn(env, nullptr, MDB_RDONLY);
-    lmdb::dbi vocab_dbi = lmdb::dbi(txn, "vocab_to_id", 0);
-    MDB_cursor* cursor;
-    if (auto rc = mdb_cursor_open(txn, vocab_dbi, &cursor)) {
-        throw lmdb::exception("mdb_cursor_open", rc);
+void InferenceEngine::configure_distribution_cache(size_t budget_bytes, const std::string& warm_set_path) {
+    this->warm_set_path = warm_set_path;
+    distribution_cache.configure(budget_bytes);
+    warm_distribution_cache();
+}
+
+void InferenceEngine::warm_distribution_cache() {
+    if (!distribution_cache.enabled()) return;
+    // A damaged key list only costs the warm start.
+    auto read_keys = [](const std::string& path) {
+        try {
+            return cache_key_file::read(path);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: ignoring " << e.what() << std::endl;
+            return std::vector<uint64_t>();
+        }
+    };
+    const std::string* source = &warm_set_path;
+    std::vector<uint64_t> keys;
+    if (!warm_set_path.empty()) keys = read_keys(warm_set_path);
+    if (keys.empty()) {
+        source = &hot_tokens_path;
+        keys = read_keys(hot_tokens_path);
+    }
+    if (keys.empty()) return;
+
+    // Shards fill at different rates; give up once a long run of keys finds nowhere to go.
+    const size_t MAX_REJECTED_IN_A_ROW = 1024;
+    lmdb::txn txn(env, nullptr, MDB_RDONLY);
+    size_t loaded = 0, rejected_in_a_row = 0;
+    for (uint64_t key : keys) {
+        uint32_t token_id = DistributionCache::token_of(key);
+        bool is_next = DistributionCache::table_of(key) == DistributionCache::NEXT;
+        if (is_next ? !distribution_keys.has_next(token_id) : !distribution_keys.has_prev(token_id)) continue;
+        Distribution d = fetch_distribution(txn, is_next ? p_next_dbi : p_prev_dbi, token_id);
+        if (d.empty()) continue;
+        if (distribution_cache.insert(key, d.entries, d.size, false)) {
+            loaded++;
+            rejected_in_a_row = 0;
+        } else if (++rejected_in_a_row >= MAX_REJECTED_IN_A_ROW) {
+            break;
+        }
     }
-    MDB_val key, data;
-    while (mdb_cursor_get(cursor, &key, &data, MDB_NEXT) == 0) {
-        std::string token_str(static_cast<char*>(key.mv_data), key.mv_size);
-        uint32_t token_id = *static_cast<uint32_t*>(data.mv_data);
-        vocab_to_id[token_str] = token_id;
+    std::cout << "Distribution cache warmed with " << loaded << " distributions (" << distribution_cache.bytes() / 1024
+              << " KB) from " << *source << std::endl;
+}
+
+void InferenceEngine::save_distribution_cache() const {
+    if (!distribution_cache.enabled() || warm_set_path.empty()) return;
+    std::vector<uint64_t> keys = distribution_cache.keys();
+    if (!keys.empty()) cache_key_file::write(warm_set_path, keys);
+}
+
+void InferenceEngine::configure_prefix_cache(size_t budget_bytes, size_t min_length) {
+    prefix_cache.configure(budget_bytes, min_length);
+}
+
+void InferenceEngine::configure_retrieval_cache(size_t capacity, uint32_t count_cap) {
+    retrieval_cache.configure(capacity, count_cap);
+}
+
+void InferenceEngine::set_metrics_enabled(bool on) {
+    // The index always counts its upper-layer descent; start from zero with the rest.
+    ann_index->metric_hops = 0;
+    ann_index->metric_distance_computations = 0;
+    ann_index->setCollectMetrics(on);
+    metrics::enable(on);
+}
+
+void InferenceEngine::set_attention_config(const AttentionConfig& cfg) {
+    attention_config = cfg;
+    // Prefix states only hold for whole-context, undecayed attention; under any other the
+    // cache would never be used, so release it.
+    if (cfg.window != 0 || cfg.decay != 1.0f) prefix_cache.configure(0, prefix_cache.min_prefix_length());
+}
+
+void InferenceEngine::set_sampler_config(const SamplerConfig& cfg) {
+    sampler_config = cfg;
+    init_context(default_context);
+    for (auto& ctx : worker_contexts) init_context(*ctx);
+}
+
+// DBI handles outlive the txn that opens them, so resolve the table names once.
+void InferenceEngine::open_tables() {
+    lmdb::txn txn(env, nullptr, MDB_RDONLY);
+    p_next_dbi = lmdb::dbi(txn, "p_next_given_current", MDB_INTEGERKEY);
+    p_prev_dbi = lmdb::dbi(txn, "p_prev_given_current", MDB_INTEGERKEY);
+    mem_dbi = lmdb::dbi(txn, "memory_outcomes", MDB_INTEGERKEY);
+}
+
+void InferenceEngine::init_context(InferenceContext& ctx) const {
+    ctx.sampler.configure(sampler_config);
+    ctx.sampler.reserve(vocab.id_space());
+    ctx.score_buffer.reserve(vocab.id_space());
+}
+
+void InferenceEngine::load_vocabulary(const std::string& dbPath, const std::string& tokenizerPath) {
+    std::string vocab_path = dbPath + "/vocab.bin";
+    std::ifstream probe(vocab_path, std::ios::binary);
+    if (!probe.is_open()) {
+        std::cout << "No compiled vocabulary at " << vocab_path << ", building it from " << tokenizerPath << std::endl;
+        compile_vocab_from_tokenizer(tokenizerPath, vocab_path);
     }
-    mdb_cursor_close(cursor);
-    id_to_vocab.resize(vocab_to_id.size() + 100); // Add a buffer
-    for(const auto& pair : vocab_to_id) {
-        if(pair.second >= id_to_vocab.size()) id_to_vocab.resize(pair.second + 100);
-        id_to_vocab[pair.second] = pair.first;
+    vocab.open(vocab_path);
+    std::cout << "Vocabulary mapped. Total tokens: " << vocab.size() << std::endl;
+
+    std::string bpe_path = dbPath + "/bpe.bin";
+    if (!std::ifstream(bpe_path, std::ios::binary).is_open()) {
+        try {
+            std::cout << "No compiled BPE tokenizer at " << bpe_path << ", building it from " << tokenizerPath << std::endl;
+            BpeEncoder::compile(tokenizerPath, bpe_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: could not compile BPE tokenizer (" << e.what() << ")." << std::endl;
+        }
     }
-    std::cout << "Vocabulary loaded. Total tokens: " << vocab_to_id.size() << std::endl;
 }
 
-std::string InferenceEngine::predict_next_token(const std::string& context) {
-    const float ATTENTION_MULTIPLIER = 10000.0f;
-    const float REPETITION_PENALTY = 1.5f;
-    const int TOP_K = 40;
-    const int NUM_NEIGHBORS = 25;
-    const int VECTOR_DIMENSION = 256;
+// Indexed by model id, so generated ids need no translation on the way out.
+void InferenceEngine::build_detokenizer() {
+    detokenizer.build(vocab.id_space(), [this](uint32_t id, std::string& out) {
+        uint32_t token_id = id_map.to_tokenizer(id);
+        if (bpe.is_loaded()) bpe.decode(token_id, out);
+        else out.append(vocab.token(token_id));
+    });
+}
 
-    // THE FIX: Use our own robust tokenizer.
-    std::vector<std::string> context_tokens = tokenize(context);
-    if (context_tokens.empty()) return "[EMPTY_CONTEXT]";
+void InferenceEngine::mark_special_tokens() {
+    special_tokens.assign(vocab.id_space(), 0);
+    for (uint32_t id = 0; id < vocab.id_space(); ++id) {
+        std::string_view text = token_view(id);
+        special_tokens[id] = text.empty() || text.find('[') != std::string_view::npos;
+    }
+}
+
+bool InferenceEngine::encode_context(InferenceContext& ctx, const std::string& context, bool& is_responding_turn) const {
+    // Map the context to the ids the model was trained on: the BPE encoder when the tokenizer
+    // file has merges, otherwise the word tokenizer plus vocabulary lookups, then through the
+    // id map when the model was trained with frequency-ordered ids.
+    std::vector<uint32_t>& context_ids = ctx.context_ids;
+    metrics::StageTimer timer(metrics::TOKENIZE);
+    if (bpe.is_loaded()) {
+        bpe.encode(context, context_ids, ctx.bpe_workspace);
+        if (context_ids.empty()) return false;
+        timer.next(metrics::VOCAB_LOOKUP);
+        id_map.to_model(context_ids);
+        is_responding_turn = (context_ids.back() == response_token_id);
+        if (is_responding_turn) context_ids.pop_back();
+    } else {
+        // Views into the tokenizer's arena; valid for the rest of this call.
+        const std::vector<std::string_view>& context_tokens = ctx.tokenizer.tokenize(context);
+        if (context_tokens.empty()) return false;
+        timer.next(metrics::VOCAB_LOOKUP);
+        is_responding_turn = (context_tokens.back() == "[RESPONSE]");
+        size_t n = context_tokens.size() - (is_responding_turn ? 1 : 0); // Exclude [RESPONSE]
+        context_ids.clear();
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t token_id = vocab.lookup(context_tokens[i]);
+            if (token_id != CompiledVocab::NOT_FOUND) context_ids.push_back(id_map.to_model(token_id));
+        }
+    }
+    return true;
+}
 
-    bool is_responding_turn = (context_tokens.back() == "[RESPONSE]");
+std::unique_ptr<InferenceContext> InferenceEngine::create_context() const {
+    std::unique_ptr<InferenceContext> ctx(new InferenceContext());
+    init_context(*ctx);
+    return ctx;
+}
 
+bool InferenceEngine::encode(InferenceContext& ctx, const std::string& text, std::vector<uint32_t>& ids) const {
+    bool is_responding_turn = false;
+    if (!encode_context(ctx, text, is_responding_turn)) {
+        ids.clear();
+        return false;
+    }
+    ids.assign(ctx.context_ids.begin(), ctx.context_ids.end());
+    if (is_responding_turn && response_token_id != BpeEncoder::NO_TOKEN) ids.push_back(response_token_id);
+    return true;
+}
+
+uint32_t InferenceEngine::predict_in_txn(InferenceContext& ctx, bool is_responding_turn) const {
     try {
-        if (is_responding_turn) {
-            // --- MODE 1: RESPONDING (Pure Retrieval from Q&A Memory) ---
-            std::vector<float> memory_scores(id_to_vocab.size(), 0.0f);
-            std::vector<float> query_vec(VECTOR_DIMENSION, 0.0f);
-            for(size_t i = 0; i < context_tokens.size() - 1; ++i) { // Exclude [RESPONSE]
-                if(vocab_to_id.count(context_tokens[i])) {
-                    query_vec[vocab_to_id.at(context_tokens[i]) % VECTOR_DIMENSION] += 1.0f;
-                }
-            }
+        MDB_txn* txn = ctx.txn.begin(env);
+        DistributionSource dists{txn, p_next_dbi, p_prev_dbi, nullptr, &distribution_keys};
+        uint32_t prediction = predict_id(ctx, ctx.context_ids, is_responding_turn, txn, dists);
+        ctx.txn.reset();
+        return prediction;
+    } catch (const std::exception& e) {
+        ctx.txn.reset();
+        std::cerr << "Error during prediction: " << e.what() << std::endl;
+        return DB_ERROR;
+    }
+}
+
+std::string InferenceEngine::predict_next_token(InferenceContext& ctx, const std::string& context) const {
+    FMM_TRACE_SPAN("inference", "predict_next_token");
+    bool is_responding_turn;
+    if (!encode_context(ctx, context, is_responding_turn)) return std::string(prediction_view(EMPTY_CONTEXT));
+    return std::string(prediction_view(predict_in_txn(ctx, is_responding_turn)));
+}
 
-            if (ann_index->getCurrentElementCount() > 0) {
-                auto result = ann_index->searchKnn(query_vec.data(), NUM_NEIGHBORS);
-                lmdb::txn txn(env, nullptr, MDB_RDONLY);
-                lmdb::dbi mem_dbi = lmdb::dbi(txn, "memory_outcomes", MDB_INTEGERKEY);
-                while(!result.empty()) {
-                    MDB_val outcome_data;
-                    uint64_t mem_idx = result.top().second;
-                    lmdb::val mem_key(mem_idx);
-                    if (mdb_get(txn, mem_dbi, &mem_key.mdb_val, &outcome_data) == 0) {
-                        uint32_t outcome_id = *static_cast<uint32_t*>(outcome_data.mv_data);
-                        memory_scores[outcome_id] += 1.0f / (1.0f + result.top().first);
-                    }
-                    result.pop();
+uint32_t InferenceEngine::predict_next_id(InferenceContext& ctx, const uint32_t* ids, size_t n) const {
+    FMM_TRACE_SPAN("inference", "predict_next_id");
+    bool is_responding_turn = n > 0 && ids[n - 1] == response_token_id;
+    if (is_responding_turn) n--;
+    if (n == 0 && !is_responding_turn) return EMPTY_CONTEXT;
+    // Reuses the context's buffer. ids may point into it, at the start or further in: then the
+    // ids are moved to the front in place, which a forward copy does safely, and never
+    // assigned from the vector's own range.
+    std::vector<uint32_t>& buf = ctx.context_ids;
+    std::less<const uint32_t*> before;
+    if (!before(ids, buf.data()) && before(ids, buf.data() + buf.size())) {
+        if (ids != buf.data()) std::copy(ids, ids + n, buf.begin());
+        buf.resize(n);
+    } else {
+        buf.assign(ids, ids + n);
+    }
+    return predict_in_txn(ctx, is_responding_turn);
+}
+
+std::vector<std::string> InferenceEngine::predict_batch(const Context* contexts, size_t count) {
+    std::vector<uint32_t> predictions(count);
+    predict_batch(contexts, count, predictions.data());
+    std::vector<std::string> results(count);
+    for (size_t i = 0; i < count; ++i) results[i] = prediction_view(predictions[i]);
+    return results;
+}
+
+void InferenceEngine::predict_batch(const Context* contexts, size_t count, uint32_t* results) {
+    if (count == 0) return;
+    FMM_TRACE_SPAN("inference", "predict_batch");
+
+    const int num_workers = omp_get_max_threads();
+    while (worker_contexts.size() < static_cast<size_t>(num_workers)) worker_contexts.push_back(create_context());
+
+    // Phase 1: encode every context on the workers.
+    std::vector<std::vector<uint32_t>> batch_ids(count);
+    std::vector<char> responding(count, 0), valid(count, 0);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (size_t i = 0; i < count; ++i) {
+        InferenceContext& ctx = *worker_contexts[omp_get_thread_num()];
+        bool is_responding_turn;
+        if (!encode_context(ctx, contexts[i], is_responding_turn)) {
+            results[i] = EMPTY_CONTEXT;
+            continue;
+        }
+        batch_ids[i] = ctx.context_ids;
+        responding[i] = is_responding_turn;
+        valid[i] = 1;
+    }
+
+    try {
+        // Phase 2: fetch every distribution the continuing contexts need, once per unique
+        // key. The pointers stay valid while shared_txn is open; workers only read them.
+        lmdb::txn shared_txn(env, nullptr, MDB_RDONLY);
+        std::vector<uint32_t> next_keys, prev_keys;
+        for (size_t i = 0; i < count; ++i) {
+            if (!valid[i] || responding[i] || batch_ids[i].empty()) continue;
+            size_t begin = attention_begin(batch_ids[i].size(), attention_config);
+            next_keys.insert(next_keys.end(), batch_ids[i].begin() + begin, batch_ids[i].end());
+            prev_keys.push_back(batch_ids[i].back());
+        }
+        PrefetchedDistributions prefetched;
+        metrics::StageTimer fetch_timer(metrics::LMDB_FETCH);
+        prefetched.fetch(shared_txn, p_next_dbi, p_prev_dbi, next_keys, prev_keys, &distribution_keys, &distribution_cache);
+        fetch_timer.stop();
+
+        // Phase 3: score on the workers, each with its own read txn for anything not
+        // prefetched (memory outcomes).
+        #pragma omp parallel
+        {
+            InferenceContext& ctx = *worker_contexts[omp_get_thread_num()];
+            #pragma omp for schedule(dynamic, 16)
+            for (size_t i = 0; i < count; ++i) {
+                if (!valid[i]) continue;
+                try {
+                    MDB_txn* txn = ctx.txn.begin(env);
+                    // Seed per context, not per worker, so results do not depend on scheduling.
+                    if (sampler_config.fixed_seed) ctx.sampler.reseed(sampler_config.seed + i);
+                    ctx.context_ids.swap(batch_ids[i]);
+                    DistributionSource dists{txn, p_next_dbi, p_prev_dbi, &prefetched, &distribution_keys};
+                    results[i] = predict_id(ctx, ctx.context_ids, responding[i], txn, dists);
+                } catch (const std::exception&) {
+                    results[i] = DB_ERROR;
                 }
             }
-            
-            uint32_t best_token_id = 0;
-            float max_score = -1.0f;
-            for (uint32_t i = 0; i < memory_scores.size(); ++i) {
-                if (memory_scores[i] > max_score) { max_score = memory_scores[i]; best_token_id = i; }
-            }
-            if (max_score <= 0.0f) return "[NO_MEMORY_MATCH]";
-            return id_to_vocab[best_token_id];
+            ctx.txn.reset();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error during batch prediction: " << e.what() << std::endl;
+        for (size_t i = 0; i < count; ++i) if (valid[i]) results[i] = DB_ERROR;
+    }
+}
 
-        } else {
-            // --- MODE 2: CONTINUING (Creative Autocomplete with Attention) ---
-            std::vector<float> final_scores(id_to_vocab.size(), 0.0f);
-            lmdb::txn txn(env, nullptr, MDB_RDONLY);
-            lmdb::dbi p_next_dbi = lmdb::dbi(txn, "p_next_given_current", MDB_INTEGERKEY);
-            lmdb::dbi p_prev_dbi = lmdb::dbi(txn, "p_prev_given_current", MDB_INTEGERKEY);
-            MDB_val db_data;
-            
-            std::vector<uint32_t> context_ids;
-            for(const auto& token_str : context_tokens) if(vocab_to_id.count(token_str)) context_ids.push_back(vocab_to_id.at(token_str));
-            if(context_ids.empty()) return "[UNKNOWN_CONTEXT]";
-
-            uint32_t last_token_id = context_ids.back();
-            lmdb::val last_token_key(last_token_id);
-            
-            if (mdb_get(txn, p_next_dbi, &last_token_key.mdb_val, &db_data) == 0) {
-                const ProbEntry* entries = static_cast<const ProbEntry*>(db_data.mv_data);
-                for (size_t i = 0; i < db_data.mv_size / sizeof(ProbEntry); ++i) final_scores[entries[i].token_id] += entries[i].probability;
-            }
+static size_t outcome_of_label(hnswlib::labeltype label) {
+    return memory_label::outcome_id(label);
+}
 
-            if (context_ids.size() > 1) {
-                for (size_t i = 0; i < context_ids.size() - 1; ++i) {
-                    uint32_t prev_token_id = context_ids[i];
-                    lmdb::val prev_token_key(prev_token_id);
-                    float p_last_given_prev = 0.0f, p_prev_given_last = 0.0f;
-                    if (mdb_get(txn, p_next_dbi, &prev_token_key.mdb_val, &db_data) == 0) {
-                        std::vector<ProbEntry> dist(static_cast<const ProbEntry*>(db_data.mv_data), static_cast<const ProbEntry*>(db_data.mv_data) + db_data.mv_size / sizeof(ProbEntry));
-                        p_last_given_prev = get_prob(dist, last_token_id);
-                    }
-                    if (mdb_get(txn, p_prev_dbi, &last_token_key.mdb_val, &db_data) == 0) {
-                        std::vector<ProbEntry> dist(static_cast<const ProbEntry*>(db_data.mv_data), static_cast<const ProbEntry*>(db_data.mv_data) + db_data.mv_size / sizeof(ProbEntry));
-                        p_prev_given_last = get_prob(dist, prev_token_id);
-                    }
-                    float attention_score = p_last_given_prev * p_prev_given_last;
-                    if (attention_score < 1e-9) continue;
-                    if (mdb_get(txn, p_next_dbi, &prev_token_key.mdb_val, &db_data) == 0) {
-                        const ProbEntry* entries = static_cast<const ProbEntry*>(db_data.mv_data);
-                        for (size_t j = 0; j < db_data.mv_size / sizeof(ProbEntry); ++j) {
-                            final_scores[entries[j].token_id] += ATTENTION_MULTIPLIER * attention_score * entries[j].probability;
-                        }
-                    }
+MemoryVote InferenceEngine::vote_memories(InferenceContext& ctx, const std::vector<uint32_t>& context_ids, MDB_txn* txn) const {
+    const int VECTOR_DIMENSION = 256;
+
+    // A question seen verbatim in training: one hash probe instead of a graph search.
+    if (const InstructionSlot* exact = instructions.find(context_ids.data(), context_ids.size())) {
+        return MemoryVote{exact->outcome_id, exact->memory_idx};
+    }
+
+    ctx.query_vec.assign(VECTOR_DIMENSION, 0.0f);
+    for (uint32_t token_id : context_ids) {
+        ctx.query_vec[token_id % VECTOR_DIMENSION] += 1.0f;
+    }
+    if (ann_index->getCurrentElementCount() == 0) return MemoryVote{NO_MEMORY_MATCH, NO_MEMORY};
+    if (!retrieval_cache.enabled()) return search_memories(ctx, txn);
+
+    // Repeated prompts map to the same query vector: skip the search and the vote.
+    uint64_t key = retrieval_cache.key_of(ctx.query_vec);
+    MemoryVote vote;
+    if (retrieval_cache.find(key, vote)) return vote;
+    vote = search_memories(ctx, txn);
+    retrieval_cache.insert(key, vote);
+    return vote;
+}
+
+MemoryVote InferenceEngine::search_memories(InferenceContext& ctx, MDB_txn* txn) const {
+    const int NUM_NEIGHBORS = 25;
+
+    ctx.score_buffer.assign(vocab.id_space(), 0.0f);
+    std::vector<float>& memory_scores = ctx.score_buffer;
+    ctx.neighbors.clear();
+    if (outcome_labels) {
+        // The labels carry each memory's outcome, so the search itself can stop as soon as
+        // the vote among the neighbours found so far can no longer change.
+        hnswlib::OutcomeVoteStopCondition<float> stop_condition(outcome_of_label, NUM_NEIGHBORS);
+        metrics::StageTimer timer(metrics::ANN_SEARCH);
+        std::vector<std::pair<float, hnswlib::labeltype>> results = ann_index->searchStopConditionClosest(ctx.query_vec.data(), stop_condition);
+        timer.stop();
+        for (const auto& result : results) {
+            uint32_t outcome_id = memory_label::outcome_id(result.second);
+            if (outcome_id >= memory_scores.size()) continue;
+            memory_scores[outcome_id] += 1.0f / (1.0f + result.first);
+            ctx.neighbors.push_back(MemoryNeighbor{memory_label::memory_idx(result.second), outcome_id, result.first});
+        }
+    } else {
+        // Index from before labels carried the outcome: one lookup per neighbour.
+        metrics::StageTimer timer(metrics::ANN_SEARCH);
+        auto result = ann_index->searchKnn(ctx.query_vec.data(), NUM_NEIGHBORS);
+        timer.stop();
+        while(!result.empty()) {
+            MDB_val outcome_data;
+            uint64_t mem_idx = result.top().second;
+            lmdb::val mem_key(mem_idx);
+            if (mdb_get(txn, mem_dbi, &mem_key.mdb_val, &outcome_data) == 0) {
+                uint32_t outcome_id = *static_cast<uint32_t*>(outcome_data.mv_data);
+                if (outcome_id < memory_scores.size()) {
+                    memory_scores[outcome_id] += 1.0f / (1.0f + result.top().first);
+                    ctx.neighbors.push_back(MemoryNeighbor{mem_idx, outcome_id, result.top().first});
                 }
             }
-            
-            size_t lookback = std::min((size_t)15, context_ids.size());
-            for (size_t i = 0; i < lookback; ++i) {
-                final_scores[context_ids[context_ids.size() - 1 - i]] /= REPETITION_PENALTY;
-            }
-            
-            std::vector<std::pair<float, uint32_t>> sorted_scores;
-            for (uint32_t i = 0; i < final_scores.size(); ++i) {
-                if (final_scores[i] > 1e-9) { sorted_scores.push_back({final_scores[i], i}); }
-            }
-            std::sort(sorted_scores.rbegin(), sorted_scores.rend());
-            
-            if (sorted_scores.empty()) return "[NO_VALID_PREDICTION]";
-            if (sorted_scores.size() > TOP_K) { sorted_scores.resize(TOP_K); }
-
-            double total_score = 0.0;
-            for (const auto& pair : sorted_scores) { total_score += pair.first; }
-            if (total_score < 1e-9) return "[NO_CONFIDENT_PREDICTION]";
-            
-            std::mt19937 gen(std::random_device{}());
-            std::uniform_real_distribution<> dis(0.0, total_score);
-            
-            uint32_t best_token_id = sorted_scores[0].second;
-            double cumulative_score = 0.0;
-            double sample = dis(gen);
-            for (const auto& pair : sorted_scores) {
-                cumulative_score += pair.first;
-                if (sample < cumulative_score) {
-                    best_token_id = pair.second;
-                    break;
+            result.pop();
+        }
+    }
+
+    uint32_t best_token_id = 0;
+    float max_score = -1.0f;
+    for (uint32_t i = 0; i < memory_scores.size(); ++i) {
+        if (memory_scores[i] > max_score) { max_score = memory_scores[i]; best_token_id = i; }
+    }
+    if (max_score <= 0.0f) return MemoryVote{NO_MEMORY_MATCH, NO_MEMORY};
+
+    MemoryVote vote{best_token_id, NO_MEMORY};
+    float best_distance = 0.0f;
+    for (const MemoryNeighbor& n : ctx.neighbors) {
+        if (n.outcome_id == best_token_id && (vote.memory_idx == NO_MEMORY || n.distance < best_distance)) {
+            vote.memory_idx = n.memory_idx;
+            best_distance = n.distance;
+        }
+    }
+    return vote;
+}
+
+void InferenceEngine::fetch_step_distributions(InferenceContext& ctx, const std::vector<AttentionTerm>& terms, uint32_t last_token_id, MDB_txn* txn) const {
+    ctx.next_keys.clear();
+    for (const AttentionTerm& term : terms) ctx.next_keys.push_back(term.token_id);
+    ctx.next_keys.push_back(last_token_id);
+    ctx.prev_keys.assign(1, last_token_id);
+    metrics::StageTimer timer(metrics::LMDB_FETCH);
+    ctx.step_distributions.fetch(txn, p_next_dbi, p_prev_dbi, ctx.next_keys, ctx.prev_keys, &distribution_keys, &distribution_cache);
+}
+
+bool InferenceEngine::prefix_applies(const PrefixState* prefix, size_t n) const {
+    return prefix && attention_config.decay == 1.0f && attention_begin(n, attention_config) == 0 && prefix->ids.size() < n;
+}
+
+PrefixHandle InferenceEngine::shared_prefix(InferenceContext& ctx, const std::vector<uint32_t>& ids) const {
+    if (!prefix_cache.enabled() || ids.size() < 2 || attention_config.window != 0 || attention_config.decay != 1.0f) return nullptr;
+    // Everything but the last id: the earlier tokens of the session's first continuing step.
+    size_t n = ids.size() - 1;
+    PrefixHandle longest;
+    size_t shared = prefix_cache.match(ids.data(), n, longest);
+    // A new state only pays off once it covers min_prefix_length more tokens than the one
+    // already cached; otherwise sessions that part ways a word after a common system prompt
+    // would each build a near copy of it.
+    size_t cached = longest ? longest->ids.size() : 0;
+    if (shared >= cached + prefix_cache.min_prefix_length()) {
+        try {
+            longest = build_prefix_state(ctx, ids.data(), shared, longest.get());
+            prefix_cache.insert(longest);
+        } catch (const std::exception& e) {
+            ctx.txn.reset();
+            std::cerr << "Warning: could not build a prefix state: " << e.what() << std::endl;
+        }
+    }
+    prefix_cache.record(ids.data(), n);
+    return longest;
+}
+
+// The terms of ids[0, length) and a copy of each one's p_next, so steps after the prefix
+// neither collect nor look up any of them again. Given the state of a shorter prefix of the
+// same ids, extends it: its terms are merged with those of the tokens after it, its p_next
+// copies are shared, and only terms it lacks are fetched.
+PrefixHandle InferenceEngine::build_prefix_state(InferenceContext& ctx, const uint32_t* ids, size_t length, const PrefixState* base) const {
+    FMM_TRACE_SPAN("inference", "build_prefix_state");
+    std::shared_ptr<PrefixState> state = std::make_shared<PrefixState>();
+    state->ids.assign(ids, ids + length);
+    AttentionConfig whole;
+    whole.window = 0;
+    whole.decay = 1.0f;
+    // As seen from the token right after the prefix, which the terms do not include.
+    size_t base_length = base ? base->ids.size() : 0;
+    if (base) {
+        collect_attention_terms(ids + base_length, length - base_length + 1, whole, ctx.attention.own_terms);
+        merge_attention_terms(base->terms, ctx.attention.own_terms, state->terms);
+    } else {
+        collect_attention_terms(ids, length + 1, whole, state->terms);
+    }
+
+    state->next.resize(state->terms.size());
+    ctx.next_keys.clear();
+    for (size_t i = 0; i < state->terms.size(); ++i) {
+        size_t j = base ? base->find(state->terms[i].token_id) : 0;
+        if (base && j < base->terms.size()) state->next[i] = base->next[j];
+        else ctx.next_keys.push_back(state->terms[i].token_id);
+    }
+    ctx.prev_keys.clear();
+    MDB_txn* txn = ctx.txn.begin(env);
+    metrics::StageTimer timer(metrics::LMDB_FETCH);
+    ctx.step_distributions.fetch(txn, p_next_dbi, p_prev_dbi, ctx.next_keys, ctx.prev_keys, &distribution_keys, &distribution_cache);
+    timer.stop();
+    // Shared p_next copies are counted here too: they stay alive as long as either state does.
+    state->bytes = sizeof(PrefixState) + length * sizeof(uint32_t) + state->terms.size() * (sizeof(AttentionTerm) + sizeof(CachedEntries));
+    for (size_t i = 0; i < state->terms.size(); ++i) {
+        if (!state->next[i]) {
+            const Distribution* d = ctx.step_distributions.find_next(state->terms[i].token_id);
+            if (!d || d->empty()) continue;
+            state->next[i] = std::make_shared<const std::vector<ProbEntry>>(d->entries, d->entries + d->size);
+        }
+        state->bytes += state->next[i]->size() * sizeof(ProbEntry) + DistributionCache::ENTRY_OVERHEAD;
+    }
+    ctx.txn.reset();
+    return state;
+}
+
+uint32_t InferenceEngine::predict_id(InferenceContext& ctx, const std::vector<uint32_t>& context_ids, bool is_responding_turn, MDB_txn* txn, const DistributionSource& dists,
+                                     const PrefixState* prefix) const {
+    const float ATTENTION_MULTIPLIER = 10000.0f;
+    const float REPETITION_PENALTY = 1.5f;
+
+    metrics::add(metrics::PREDICTIONS);
+    FMM_TRACE_SPAN("inference", "predict_id");
+    if (is_responding_turn) {
+        // --- MODE 1: RESPONDING (Pure Retrieval from Q&A Memory) ---
+        return vote_memories(ctx, context_ids, txn).token_id;
+    } else {
+        // --- MODE 2: CONTINUING (Creative Autocomplete with Attention) ---
+        if(context_ids.empty()) return UNKNOWN_CONTEXT;
+        // Reuse the context's score buffer; assign() keeps its capacity between calls.
+        ctx.score_buffer.assign(vocab.id_space(), 0.0f);
+        std::vector<float>& final_scores = ctx.score_buffer;
+
+        uint32_t last_token_id = context_ids.back();
+        // With a shared prefix only the terms after it are collected and fetched; the merged
+        // list is the same one collect_attention_terms would build over the whole context.
+        if (!prefix_applies(prefix, context_ids.size())) prefix = nullptr;
+        const std::vector<AttentionTerm>* fetch_terms = &ctx.attention.terms;
+        if (prefix) {
+            size_t skip = prefix->ids.size();
+            collect_attention_terms(context_ids.data() + skip, context_ids.size() - skip, attention_config, ctx.attention.own_terms);
+            merge_attention_terms(prefix->terms, ctx.attention.own_terms, ctx.attention.terms);
+            fetch_terms = &ctx.attention.own_terms;
+        } else {
+            collect_attention_terms(context_ids.data(), context_ids.size(), attention_config, ctx.attention.terms);
+        }
+        DistributionSource step = dists;
+        if (!step.prefetched) {
+            fetch_step_distributions(ctx, *fetch_terms, last_token_id, txn);
+            step.prefetched = &ctx.step_distributions;
+        }
+        auto next_of = [&](uint32_t token_id) {
+            if (prefix) {
+                size_t i = prefix->find(token_id);
+                if (i < prefix->terms.size()) {
+                    const CachedEntries& entries = prefix->next[i];
+                    return entries ? Distribution{entries->data(), entries->size()} : Distribution();
                 }
             }
-            return id_to_vocab[best_token_id];
+            return step.next(token_id);
+        };
+
+        metrics::StageTimer timer(metrics::ATTENTION);
+        Distribution last_next = step.next(last_token_id);
+        mixing::scatter_add(final_scores.data(), last_next.entries, last_next.size, 1.0f);
+
+        if (!ctx.attention.terms.empty()) {
+            Distribution last_prev = step.prev(last_token_id);
+            accumulate_attention(ctx.attention, last_token_id, last_prev, next_of,
+                                 ATTENTION_MULTIPLIER, attention_config, final_scores.data(), final_scores.size());
+        }
+
+        size_t lookback = std::min((size_t)15, context_ids.size());
+        for (size_t i = 0; i < lookback; ++i) {
+            final_scores[context_ids[context_ids.size() - 1 - i]] /= REPETITION_PENALTY;
+        }
+        timer.stop();
+        
+        return ctx.sampler.sample(final_scores);
+    }
+}
+
+std::string_view InferenceEngine::prediction_view(uint32_t id) const {
+    switch (id) {
+        case NO_CANDIDATES: return "[NO_VALID_PREDICTION]";
+        case NO_CONFIDENCE: return "[NO_CONFIDENT_PREDICTION]";
+        case NO_MEMORY_MATCH: return "[NO_MEMORY_MATCH]";
+        case UNKNOWN_CONTEXT: return "[UNKNOWN_CONTEXT]";
+        case EMPTY_CONTEXT: return "[EMPTY_CONTEXT]";
+        case DB_ERROR: return "[DB_ERROR]";
+        default: return token_view(id);
+    }
+}
+
+void InferenceEngine::start_generation(InferenceContext& ctx, const GenerationOptions& options, bool is_responding_turn, GenerationState& state) const {
+    state.start = GenerationState::clock::now();
+    state.options = options;
+    state.stats = GenerationStats();
+    state.prefix = shared_prefix(ctx, state.ids);
+    state.responding = is_responding_turn || options.respond;
+    state.retrieved = nullptr;
+    state.retrieved_size = state.retrieved_pos = 0;
+    if (options.max_tokens == 0) state.stats.stop_reason = StopReason::MAX_TOKENS;
+}
+
+void InferenceEngine::begin_generation(InferenceContext& ctx, const std::string& prompt, const GenerationOptions& options, GenerationState& state) const {
+    FMM_TRACE_SPAN("inference", "begin_generation");
+    bool is_responding_turn = false;
+    if (!encode_context(ctx, prompt, is_responding_turn)) {
+        state.ids.clear();
+        start_generation(ctx, options, false, state);
+        state.stats.stop_reason = StopReason::NO_PREDICTION;
+        return;
+    }
+    state.ids.assign(ctx.context_ids.begin(), ctx.context_ids.end());
+    start_generation(ctx, options, is_responding_turn, state);
+}
+
+void InferenceEngine::begin_generation(InferenceContext& ctx, const uint32_t* prompt_ids, size_t n, const GenerationOptions& options, GenerationState& state) const {
+    FMM_TRACE_SPAN("inference", "begin_generation");
+    bool is_responding_turn = n > 0 && prompt_ids[n - 1] == response_token_id;
+    if (is_responding_turn) n--;
+    state.ids.assign(prompt_ids, prompt_ids + n);
+    start_generation(ctx, options, is_responding_turn, state);
+    if (n == 0 && !is_responding_turn) state.stats.stop_reason = StopReason::NO_PREDICTION;
+}
+
+// The next id of a generation, or a predict_id status code. Streams from the retrieved
+// response once there is one; otherwise one prediction under the context's read txn.
+uint32_t InferenceEngine::next_id(InferenceContext& ctx, GenerationState& state) const {
+    if (state.retrieved) {
+        if (state.retrieved_pos == state.retrieved_size) {
+            state.stats.stop_reason = StopReason::END_OF_RESPONSE;
+            return NO_TOKEN;
+        }
+        return state.retrieved[state.retrieved_pos++];
+    }
+    MDB_txn* txn = ctx.txn.begin(env);
+    uint32_t id;
+    if (state.responding && state.options.whole_response && responses.is_open()) {
+        // One search picks the memory; the rest of its answer streams from the mapped store.
+        ResponseStore::Span span = responses.response(vote_memories(ctx, state.ids, txn).memory_idx);
+        id = NO_MEMORY_MATCH;
+        if (span.size > 0) {
+            state.retrieved = span.tokens;
+            state.retrieved_size = span.size;
+            state.retrieved_pos = 1;
+            id = span.tokens[0];
         }
+    } else {
+        DistributionSource dists{txn, p_next_dbi, p_prev_dbi, nullptr, &distribution_keys};
+        id = predict_id(ctx, state.ids, state.responding, txn, dists, state.prefix.get());
+    }
+    ctx.txn.reset();
+    return id;
+}
+
+uint32_t InferenceEngine::generate_step(InferenceContext& ctx, GenerationState& state) const {
+    if (state.finished()) return NO_TOKEN;
+    FMM_TRACE_SPAN("inference", "generate_step");
+    GenerationStats& stats = state.stats;
+    uint32_t id;
+    try {
+        id = next_id(ctx, state);
     } catch (const std::exception& e) {
-        std::cerr << "Error during prediction: " << e.what() << std::endl;
-        return "[DB_ERROR]";
+        ctx.txn.reset();
+        std::cerr << "Error during generation: " << e.what() << std::endl;
+        stats.stop_reason = StopReason::ERROR;
+        return NO_TOKEN;
+    }
+    if (state.finished()) return NO_TOKEN;
+    if (!is_token_id(id)) {
+        stats.stop_reason = StopReason::NO_PREDICTION;
+        return NO_TOKEN;
+    }
+    const std::vector<uint32_t>& stops = state.options.stop_token_ids;
+    if ((state.options.stop_on_special_tokens && id < special_tokens.size() && special_tokens[id]) ||
+        std::find(stops.begin(), stops.end(), id) != stops.end()) {
+        stats.stop_reason = StopReason::STOP_TOKEN;
+        return NO_TOKEN;
+    }
+
+    // Later steps continue from "prompt [RESPONSE] answer so far", as the REPL's text did.
+    if (state.responding) {
+        state.responding = false;
+        if (response_token_id != BpeEncoder::NO_TOKEN) state.ids.push_back(response_token_id);
+    }
+    state.ids.push_back(id);
+
+    GenerationState::clock::time_point now = GenerationState::clock::now();
+    if (stats.num_tokens == 0) {
+        state.first_token = now;
+        stats.time_to_first_token_ms = std::chrono::duration<double, std::milli>(now - state.start).count();
+    } else {
+        double gap_ms = std::chrono::duration<double, std::milli>(now - state.last_token).count();
+        stats.max_inter_token_ms = std::max(stats.max_inter_token_ms, gap_ms);
+        stats.mean_inter_token_ms = std::chrono::duration<double, std::milli>(now - state.first_token).count() / stats.num_tokens;
+    }
+    state.last_token = now;
+    stats.total_ms = std::chrono::duration<double, std::milli>(now - state.start).count();
+    if (++stats.num_tokens >= state.options.max_tokens) stats.stop_reason = StopReason::MAX_TOKENS;
+    return id;
+}
+
+GenerationStats InferenceEngine::generate(InferenceContext& ctx, const std::string& prompt, const GenerationOptions& options, const TokenCallback& on_token) const {
+    GenerationState state;
+    begin_generation(ctx, prompt, options, state);
+    return run_generation(ctx, state, on_token);
+}
+
+GenerationStats InferenceEngine::generate(InferenceContext& ctx, const uint32_t* prompt_ids, size_t n, const GenerationOptions& options, const TokenCallback& on_token) const {
+    GenerationState state;
+    begin_generation(ctx, prompt_ids, n, options, state);
+    return run_generation(ctx, state, on_token);
+}
+
+GenerationStats InferenceEngine::run_generation(InferenceContext& ctx, GenerationState& state, const TokenCallback& on_token) const {
+    while (!state.finished()) {
+        uint32_t id = generate_step(ctx, state);
+        if (id == NO_TOKEN) break;
+        if (on_token && !on_token(id)) {
+            state.stats.stop_reason = StopReason::CANCELLED;
+            break;
+        }
     }
-}
\ No newline at end of file
+    state.stats.total_ms = std::chrono::duration<double, std::milli>(GenerationState::clock::now() - state.start).count();
+    return state.stats;
+}
@@ -5,31 +5,255 @@
 
 #include <string>
 #include <vector>
-#include <unordered_map>
+#include <memory>
 #include <cstdint>
+#include <functional>
 #include "lmdb++.h"
 #include "hnswlib/hnswlib.h"
+#include "sampler.hpp"
+#include "vocab.hpp"
+#include "tokenizer.hpp"
+#include "bpe.hpp"
+#include "distributions.hpp"
+#include "attention.hpp"
+#include "generation.hpp"
+#include "responses.hpp"
+#include "retrieval_cache.hpp"
+#include "instruction_index.hpp"
+#include "id_map.hpp"
+#include "detokenizer.hpp"
+#include "metrics.hpp"
 
+// One memory the ANN search returned for the current context.
+struct MemoryNeighbor {
+    uint64_t memory_idx;
+    uint32_t outcome_id; // first response token
+    float distance;
+};
+
+// Everything one prediction mutates: the LMDB read txn, tokenizer and BPE scratch, the
+// sampler's RNG and the score buffers. Create one per thread with
+// InferenceEngine::create_context() and reuse it; it must not outlive the engine, and must
+// not be used by two threads at once.
+struct InferenceContext {
+    lmdb::read_txn txn;
+    WordTokenizer tokenizer;
+    BpeWorkspace bpe_workspace;
+    Sampler sampler;
+    std::vector<uint32_t> context_ids;
+    std::vector<float> score_buffer;
+    std::vector<float> query_vec;
+    std::vector<MemoryNeighbor> neighbors;
+    AttentionWorkspace attention;
+    PrefetchedDistributions step_distributions; // what one continuing step reads, fetched in key order
+    std::vector<uint32_t> next_keys;
+    std::vector<uint32_t> prev_keys;
+};
+
+// The engine holds the model (LMDB env, vocabulary, BPE tables, ANN index) and is read-only
+// after construction. Calls that take an InferenceContext are const and may run on any
+// number of threads at once, each with its own context, so one process can serve all cores
+// from a single copy of the model. The overloads without a context use engine-owned
+// contexts and, like set_sampler_config, must not run concurrently with anything else.
 class InferenceEngine {
 private:
     lmdb::env env;
-    std::unordered_map<std::string, uint32_t> vocab_to_id;
-    std::vector<std::string> id_to_vocab;
+    MDB_dbi p_next_dbi = 0;
+    MDB_dbi p_prev_dbi = 0;
+    MDB_dbi mem_dbi = 0;
+    CompiledVocab vocab;
+    BpeEncoder bpe;
+    ResponseStore responses; // full memorized responses, when the trainer wrote them
+    InstructionIndex instructions; // exact-match fast path, when the trainer wrote it
+    IdMap id_map; // tokenizer id <-> model id, when the trainer ordered ids by frequency
+    Detokenizer detokenizer; // surface text by model id
+    DistributionKeys distribution_keys; // which ids have p_next / p_prev entries; checked before any lookup
+    uint32_t response_token_id = BpeEncoder::NO_TOKEN;
+    std::vector<char> special_tokens; // ids whose text is empty or contains '[', the REPL's stop rule
 
     hnswlib::L2Space space;
     hnswlib::HierarchicalNSW<float>* ann_index = nullptr;
+    bool outcome_labels = false; // labels carry the first response token (memory_label.hpp)
+    mutable RetrievalCache retrieval_cache; // internally locked; shared by all contexts
+    mutable DistributionCache distribution_cache; // hot decoded distributions; internally locked
+    mutable PrefixCache prefix_cache; // attention state of context prefixes sessions share; internally locked
+    std::string warm_set_path;           // opt-in: warm set loaded at configuration, saved at shutdown
+    std::string hot_tokens_path;         // the trainer's hottest keys, for a first start
+
+    SamplerConfig sampler_config;
+    AttentionConfig attention_config;
+    InferenceContext default_context;                            // used by predict_next_token(context)
+    std::vector<std::unique_ptr<InferenceContext>> worker_contexts; // one per batch worker
+
+    // Maps <dbPath>/vocab.bin, compiling it from the tokenizer JSON on first use.
+    void load_vocabulary(const std::string& dbPath, const std::string& tokenizerPath);
+    void open_tables();
+    void init_context(InferenceContext& ctx) const;
+    void build_detokenizer();
+    void mark_special_tokens();
+
+    static constexpr uint64_t NO_MEMORY = UINT64_MAX;
 
-    // This function now needs the tokenizer path
-    void load_vocabulary_from_tokenizer(const std::string& tokenizerPath);
+    // Preloads the distribution cache from the saved warm set or, failing that, the trainer's
+    // hot-token list, without evicting anything. save_distribution_cache writes the warm set,
+    // if there is a warm_set_path.
+    void warm_distribution_cache();
+    void save_distribution_cache() const;
+
+    // Fills ctx.context_ids; returns false for an empty context.
+    bool encode_context(InferenceContext& ctx, const std::string& context, bool& is_responding_turn) const;
+    // Votes over the nearest memories' first response tokens. Returns the winning token (or
+    // NO_MEMORY_MATCH) and the closest memory whose response starts with it (or NO_MEMORY).
+    MemoryVote vote_memories(InferenceContext& ctx, const std::vector<uint32_t>& context_ids, MDB_txn* txn) const;
+    MemoryVote search_memories(InferenceContext& ctx, MDB_txn* txn) const;
+    // Fetches every distribution a continuing step reads (the last token's p_next and p_prev,
+    // each of `terms`' p_next) into ctx.step_distributions, one cursor sweep per table.
+    // The spans are valid while txn is.
+    void fetch_step_distributions(InferenceContext& ctx, const std::vector<AttentionTerm>& terms, uint32_t last_token_id, MDB_txn* txn) const;
+    // Whether a step over n context ids can take its earlier terms from `prefix`: attention
+    // must cover the whole context undecayed, and the last token must lie past the prefix.
+    bool prefix_applies(const PrefixState* prefix, size_t n) const;
+    // The longest cached prefix of a new session's ids, building one where this session
+    // shares enough tokens with an earlier one. Null when none applies.
+    PrefixHandle shared_prefix(InferenceContext& ctx, const std::vector<uint32_t>& ids) const;
+    PrefixHandle build_prefix_state(InferenceContext& ctx, const uint32_t* ids, size_t length, const PrefixState* base = nullptr) const;
+    uint32_t predict_id(InferenceContext& ctx, const std::vector<uint32_t>& context_ids, bool is_responding_turn, MDB_txn* txn, const DistributionSource& dists,
+                        const PrefixState* prefix = nullptr) const;
+    // predict_id under the context's own read txn, DB_ERROR if LMDB throws.
+    uint32_t predict_in_txn(InferenceContext& ctx, bool is_responding_turn) const;
+    uint32_t next_id(InferenceContext& ctx, GenerationState& state) const;
+    // Runs begun generation to completion, streaming ids to on_token.
+    GenerationStats run_generation(InferenceContext& ctx, GenerationState& state, const std::function<bool(uint32_t)>& on_token) const;
+    // Resets state for a generation whose prompt ids are already in state.ids.
+    void start_generation(InferenceContext& ctx, const GenerationOptions& options, bool is_responding_turn, GenerationState& state) const;
 
 public:
+    using Context = std::string;
+    using TokenCallback = std::function<bool(uint32_t token_id)>; // return false to cancel
+
+    static constexpr uint32_t NO_TOKEN = UINT32_MAX;
+
+    // Returned by predict_next_id and predict_batch in place of a token id; prediction_view
+    // names them.
+    static constexpr uint32_t NO_CANDIDATES = Sampler::NO_CANDIDATES;
+    static constexpr uint32_t NO_CONFIDENCE = Sampler::NO_CONFIDENCE;
+    static constexpr uint32_t NO_MEMORY_MATCH = UINT32_MAX - 2;
+    static constexpr uint32_t UNKNOWN_CONTEXT = UINT32_MAX - 3;
+    static constexpr uint32_t EMPTY_CONTEXT = UINT32_MAX - 4;
+    static constexpr uint32_t DB_ERROR = UINT32_MAX - 5;
+    static bool is_token_id(uint32_t id) { return id < DB_ERROR; }
+
+    // Token ids in this API (callbacks, stop_token_ids, token_text) are model ids. They equal
+    // the tokenizer's ids unless the model was trained with frequency remapping (id_map.hpp).
+    uint32_t model_id(uint32_t tokenizer_id) const { return id_map.to_model(tokenizer_id); }
+    uint32_t tokenizer_id(uint32_t model_id) const { return id_map.to_tokenizer(model_id); }
+
     // THE DEFINITIVE FIX:
     // The constructor now correctly takes two arguments, matching the call in main.cpp
     // and the definition in inference.cpp.
-    InferenceEngine(const std::string& dbPath, const std::string& tokenizerPath);
-    
+    // warmSetPath, if given, is the distribution cache's warm set (see
+    // configure_distribution_cache), so startup warms the cache from it once.
+    InferenceEngine(const std::string& dbPath, const std::string& tokenizerPath, const std::string& warmSetPath = std::string());
+
     ~InferenceEngine();
-    std::string predict_next_token(const std::string& context);
+    // Also applies to contexts created afterwards; existing ones keep their own sampler.
+    void set_sampler_config(const SamplerConfig& cfg);
+
+    // Window and distance decay of continuing-mode attention. A window bounds the per-token
+    // work no matter how long the context grows, at the price of different predictions; the
+    // default attends to the whole context, undecayed, as the model always has.
+    void set_attention_config(const AttentionConfig& cfg);
+
+    // Caches retrieval votes by query vector; see RetrievalCache::configure. On by default.
+    // Like set_sampler_config, not to be called while other threads use the engine.
+    void configure_retrieval_cache(size_t capacity, uint32_t count_cap = 0);
+    double retrieval_cache_hit_rate() const { return retrieval_cache.hit_rate(); }
+    uint64_t retrieval_cache_hits() const { return retrieval_cache.hits(); }
+    uint64_t retrieval_cache_misses() const { return retrieval_cache.misses(); }
+
+    // Decoded distributions of the hottest tokens, bounded by bytes and shared by all contexts.
+    // 64 MB by default; 0 disables it. Re-warms from the trainer's hot-token list or, given
+    // warm_set_path, from the set saved there by an earlier engine, which then saves its own
+    // set there at shutdown. Without one the engine writes nothing, so the model directory
+    // may be read-only and shared. Like set_sampler_config, not to be called while other
+    // threads use the engine.
+    static constexpr size_t DEFAULT_DISTRIBUTION_CACHE_BYTES = 64u << 20;
+    void configure_distribution_cache(size_t budget_bytes, const std::string& warm_set_path = std::string());
+    double distribution_cache_hit_rate() const { return distribution_cache.hit_rate(); }
+    uint64_t distribution_cache_hits() const { return distribution_cache.hits(); }
+    uint64_t distribution_cache_misses() const { return distribution_cache.misses(); }
+    size_t distribution_cache_bytes() const { return distribution_cache.bytes(); }
+
+    // Attention state of context prefixes that sessions share, such as a common system
+    // prompt, built once a second session starts with the same min_length or more tokens.
+    // Only used with whole-context, undecayed attention (window 0, decay 1): a shorter window
+    // never reaches far enough back for a long prefix to cost anything, so set_attention_config
+    // disables it for any other. 16 MB by default; 0 disables it. Like set_sampler_config, not
+    // to be called while other threads use the engine.
+    static constexpr size_t DEFAULT_PREFIX_CACHE_BYTES = 16u << 20;
+    static constexpr size_t DEFAULT_MIN_PREFIX_LENGTH = 32;
+    void configure_prefix_cache(size_t budget_bytes, size_t min_length = DEFAULT_MIN_PREFIX_LENGTH);
+    bool prefix_cache_enabled() const { return prefix_cache.enabled(); }
+    uint64_t prefix_cache_hits() const { return prefix_cache.hits(); }
+    uint64_t prefix_cache_misses() const { return prefix_cache.misses(); }
+    size_t prefix_cache_bytes() const { return prefix_cache.bytes(); }
+
+    // Per-stage latency histograms and counters of every engine in the process, read with
+    // metrics::snapshot() or metrics::prometheus_text(); see metrics.hpp. Off by default.
+    // Turning them on also makes ANN searches count their base-layer hops and distances.
+    void set_metrics_enabled(bool on);
+
+    // A fresh per-thread context, configured with the current sampler settings.
+    std::unique_ptr<InferenceContext> create_context() const;
+
+    std::string predict_next_token(InferenceContext& ctx, const std::string& context) const;
+    std::string predict_next_token(const std::string& context) {
+        return predict_next_token(default_context, context);
+    }
+
+    // The id-level API: text is encoded once, then ids go in and ids come out, and nothing
+    // builds a string until the caller detokenizes. encode replaces `ids` with the model ids of
+    // `text` (false if it has none); a trailing [RESPONSE] id marks a responding turn here and
+    // in every call below that takes ids.
+    bool encode(InferenceContext& ctx, const std::string& text, std::vector<uint32_t>& ids) const;
+    // The next token id, or one of the status codes above. ids may point anywhere into
+    // ctx.context_ids.
+    uint32_t predict_next_id(InferenceContext& ctx, const uint32_t* ids, size_t n) const;
+
+    // Streams generated token ids to on_token until a stop token, max_tokens, a failed
+    // prediction or cancellation, and returns time-to-first-token and inter-token latency.
+    GenerationStats generate(InferenceContext& ctx, const std::string& prompt, const GenerationOptions& options, const TokenCallback& on_token) const;
+    GenerationStats generate(const std::string& prompt, const GenerationOptions& options, const TokenCallback& on_token) {
+        return generate(default_context, prompt, options, on_token);
+    }
+    GenerationStats generate(InferenceContext& ctx, const uint32_t* prompt_ids, size_t n, const GenerationOptions& options, const TokenCallback& on_token) const;
+
+    // The same generation one token at a time, for callers that interleave many of them.
+    // generate_step returns the next token id, or NO_TOKEN once state.finished().
+    void begin_generation(InferenceContext& ctx, const std::string& prompt, const GenerationOptions& options, GenerationState& state) const;
+    void begin_generation(InferenceContext& ctx, const uint32_t* prompt_ids, size_t n, const GenerationOptions& options, GenerationState& state) const;
+    uint32_t generate_step(InferenceContext& ctx, GenerationState& state) const;
+
+    // Surface text of one token as the model's tokenizer writes it. The view points into the
+    // engine and stays valid as long as it does; it is empty for ids outside the vocabulary.
+    std::string_view token_view(uint32_t token_id) const { return detokenizer.text(token_id); }
+    std::string token_text(uint32_t token_id) const { return std::string(token_view(token_id)); }
+    // Writes the text of ids[0..n) into buf without allocating; see Detokenizer::decode.
+    size_t detokenize(const uint32_t* ids, size_t n, char* buf, size_t capacity, size_t* consumed = nullptr) const {
+        return detokenizer.decode(ids, n, buf, capacity, consumed);
+    }
+    // A prediction's text: the token's, or the bracketed name of a status code.
+    std::string_view prediction_view(uint32_t id) const;
+
+    // Predicts the next token for every context, spread over the OpenMP thread team. Each
+    // worker has its own read txn and scratch buffers, and the distributions the batch
+    // needs are fetched once up front, so contexts sharing token ids share the lookups.
+    std::vector<std::string> predict_batch(const Context* contexts, size_t count);
+    std::vector<std::string> predict_batch(const std::vector<Context>& contexts) {
+        return predict_batch(contexts.data(), contexts.size());
+    }
+    // The same, writing token ids (or status codes) to predictions[0..count).
+    void predict_batch(const Context* contexts, size_t count, uint32_t* predictions);
 };
 
-#endif // FMM_INFERENCE_HPP
\ No newline at end of file
+#endif // FMM_INFERENCE_HPP
@@ -0,0 +1,140 @@
+// src/instruction_index.hpp (Exact-match index from instruction fingerprint to memory outcome)
+
+#ifndef FMM_INSTRUCTION_INDEX_HPP
+#define FMM_INSTRUCTION_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+#include "vocab.hpp"
+
+// 64-bit fingerprint of a canonical instruction: its token ids, [INSTRUCTION] and
+// [RESPONSE] markers excluded. Never 0, which marks an empty slot.
+inline uint64_t instruction_fingerprint(const uint32_t* ids, size_t n) {
+    uint64_t h = vocab_hash::hash_bytes(reinterpret_cast<const char*>(ids), n * sizeof(uint32_t));
+    return h ? h : 1;
+}
+
+// On-disk layout of instructions.bin (all fields native-endian):
+//   InstructionIndexHeader
+//   InstructionSlot slots[num_slots]   open addressing, linear probing, power-of-two size
+struct InstructionIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_entries;
+    uint64_t num_slots;
+};
+
+struct InstructionSlot {
+    uint64_t fingerprint; // 0 = empty
+    uint64_t memory_idx;  // a memory with this instruction whose response starts with outcome_id
+    uint32_t outcome_id;  // the most common first response token for this instruction
+    uint32_t count;       // how many memories share the instruction
+};
+
+class InstructionIndex {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    void open(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(InstructionIndexHeader)) throw std::runtime_error("instruction index too small: " + path);
+        header = reinterpret_cast<const InstructionIndexHeader*>(file.data());
+        if (std::memcmp(header->magic, "FMMINSTR", 8) != 0 || header->version != FORMAT_VERSION) {
+            throw std::runtime_error("not an instruction index (or wrong version): " + path);
+        }
+        if (header->num_slots == 0 || (header->num_slots & (header->num_slots - 1)) != 0 ||
+            sizeof(InstructionIndexHeader) + header->num_slots * sizeof(InstructionSlot) > file.size()) {
+            throw std::runtime_error("corrupt instruction index: " + path);
+        }
+        slots = reinterpret_cast<const InstructionSlot*>(file.data() + sizeof(InstructionIndexHeader));
+    }
+
+    bool is_open() const { return header != nullptr; }
+    uint64_t size() const { return header ? header->num_entries : 0; }
+
+    // One hash and, almost always, one probe. nullptr when the instruction was never trained.
+    const InstructionSlot* find(const uint32_t* ids, size_t n) const {
+        if (!header || n == 0) return nullptr;
+        uint64_t fingerprint = instruction_fingerprint(ids, n);
+        uint64_t mask = header->num_slots - 1;
+        for (uint64_t i = fingerprint & mask;; i = (i + 1) & mask) {
+            if (slots[i].fingerprint == fingerprint) return &slots[i];
+            if (slots[i].fingerprint == 0) return nullptr;
+        }
+    }
+
+private:
+    MappedFile file;
+    const InstructionIndexHeader* header = nullptr;
+    const InstructionSlot* slots = nullptr;
+};
+
+// Collects (instruction, first response token, memory) triples during training and writes
+// instructions.bin, keeping the majority outcome for instructions that occur more than once.
+class InstructionIndexWriter {
+public:
+    void add(const uint32_t* ids, size_t n, uint32_t outcome_id, uint64_t memory_idx) {
+        if (n == 0) return;
+        Group& group = groups[instruction_fingerprint(ids, n)];
+        for (Outcome& o : group) {
+            if (o.outcome_id == outcome_id) {
+                o.count++;
+                return;
+            }
+        }
+        group.push_back(Outcome{outcome_id, memory_idx, 1});
+    }
+
+    size_t size() const { return groups.size(); }
+
+    void write(const std::string& outPath) const {
+        uint64_t num_slots = 16;
+        while (num_slots < groups.size() * 2) num_slots <<= 1; // load factor <= 0.5
+        std::vector<InstructionSlot> slots(num_slots);
+        std::memset(slots.data(), 0, slots.size() * sizeof(InstructionSlot));
+        for (const auto& entry : groups) {
+            // Majority outcome; ties go to the outcome seen first.
+            const Outcome* best = &entry.second.front();
+            uint32_t total = 0;
+            for (const Outcome& o : entry.second) {
+                total += o.count;
+                if (o.count > best->count) best = &o;
+            }
+            uint64_t i = entry.first & (num_slots - 1);
+            while (slots[i].fingerprint != 0) i = (i + 1) & (num_slots - 1);
+            slots[i] = InstructionSlot{entry.first, best->memory_idx, best->outcome_id, total};
+        }
+
+        InstructionIndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "FMMINSTR", 8);
+        header.version = InstructionIndex::FORMAT_VERSION;
+        header.num_entries = groups.size();
+        header.num_slots = num_slots;
+
+        replace_file(outPath, [&](std::ofstream& out) {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(InstructionSlot));
+        });
+    }
+
+private:
+    struct Outcome {
+        uint32_t outcome_id;
+        uint64_t memory_idx; // first memory seen with this outcome
+        uint32_t count;
+    };
+    using Group = std::vector<Outcome>;
+    std::unordered_map<uint64_t, Group> groups;
+};
+
+#endif // FMM_INSTRUCTION_INDEX_HPP
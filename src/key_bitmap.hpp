@@ -0,0 +1,109 @@
+// src/key_bitmap.hpp (Which token ids have a p_next / p_prev distribution, one bit per id)
+
+#ifndef FMM_KEY_BITMAP_HPP
+#define FMM_KEY_BITMAP_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// On-disk layout of distribution_keys.bin (all fields native-endian):
+//   KeyBitmapHeader
+//   uint64_t next_words[(num_ids + 63) / 64]   bit i set: p_next_given_current has key i
+//   uint64_t prev_words[(num_ids + 63) / 64]   bit i set: p_prev_given_current has key i
+// Token ids are dense, so an exact bitmap is smaller than a Bloom filter of useful accuracy
+// and never sends a lookup to LMDB for nothing.
+struct KeyBitmapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_ids;
+};
+
+class DistributionKeys {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    void open(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(KeyBitmapHeader)) throw std::runtime_error("key bitmap too small: " + path);
+        header = reinterpret_cast<const KeyBitmapHeader*>(file.data());
+        if (std::memcmp(header->magic, "FMMKEYS", 8) != 0 || header->version != FORMAT_VERSION) {
+            throw std::runtime_error("not a key bitmap (or wrong version): " + path);
+        }
+        size_t num_words = (header->num_ids + 63) / 64;
+        if (sizeof(KeyBitmapHeader) + 2 * num_words * sizeof(uint64_t) > file.size()) {
+            throw std::runtime_error("truncated key bitmap: " + path);
+        }
+        next_words = reinterpret_cast<const uint64_t*>(file.data() + sizeof(KeyBitmapHeader));
+        prev_words = next_words + num_words;
+    }
+
+    bool is_open() const { return header != nullptr; }
+
+    // Without a bitmap (models trained before it existed) every id may have an entry.
+    bool has_next(uint32_t token_id) const { return !header || test(next_words, token_id); }
+    bool has_prev(uint32_t token_id) const { return !header || test(prev_words, token_id); }
+
+    // Removes the ids a table has no entry for from a key list, before it is fetched.
+    void drop_missing_next(std::vector<uint32_t>& keys) const { drop_missing(keys, next_words); }
+    void drop_missing_prev(std::vector<uint32_t>& keys) const { drop_missing(keys, prev_words); }
+
+private:
+    MappedFile file;
+    const KeyBitmapHeader* header = nullptr;
+    const uint64_t* next_words = nullptr;
+    const uint64_t* prev_words = nullptr;
+
+    bool test(const uint64_t* words, uint32_t token_id) const {
+        return token_id < header->num_ids && ((words[token_id >> 6] >> (token_id & 63)) & 1);
+    }
+
+    void drop_missing(std::vector<uint32_t>& keys, const uint64_t* words) const {
+        if (!header) return;
+        keys.erase(std::remove_if(keys.begin(), keys.end(), [&](uint32_t id) { return !test(words, id); }), keys.end());
+    }
+};
+
+// Records the keys the trainer writes to each table, then writes distribution_keys.bin.
+class DistributionKeysWriter {
+public:
+    void add_next(uint32_t token_id) { set(next_bits, token_id); }
+    void add_prev(uint32_t token_id) { set(prev_bits, token_id); }
+
+    void write(const std::string& outPath) const {
+        size_t num_words = std::max(next_bits.size(), prev_bits.size());
+        std::vector<uint64_t> next_words(next_bits), prev_words(prev_bits);
+        next_words.resize(num_words, 0);
+        prev_words.resize(num_words, 0);
+
+        KeyBitmapHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "FMMKEYS", 8);
+        header.version = DistributionKeys::FORMAT_VERSION;
+        header.num_ids = num_words * 64;
+
+        replace_file(outPath, [&](std::ofstream& out) {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(next_words.data()), num_words * sizeof(uint64_t));
+            out.write(reinterpret_cast<const char*>(prev_words.data()), num_words * sizeof(uint64_t));
+        });
+    }
+
+private:
+    std::vector<uint64_t> next_bits;
+    std::vector<uint64_t> prev_bits;
+
+    static void set(std::vector<uint64_t>& bits, uint32_t token_id) {
+        if ((token_id >> 6) >= bits.size()) bits.resize((token_id >> 6) + 1, 0);
+        bits[token_id >> 6] |= 1ULL << (token_id & 63);
+    }
+};
+
+#endif // FMM_KEY_BITMAP_HPP
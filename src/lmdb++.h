@@ -8,6 +8,7 @@
 #include <stdexcept>
 #include <cstdint>
 #include <cstring>
+#include "trace.hpp"
 
 namespace lmdb {
 
@@ -35,22 +36,93 @@ public:
         if (auto rc = mdb_env_open(mdb_env, path, flags, mode)) throw exception("mdb_env_open", rc);
     }
     ~env() { if (mdb_env) mdb_env_close(mdb_env); }
-    operator MDB_env*() { return mdb_env; }
+    operator MDB_env*() const { return mdb_env; }
 };
 
 // Transaction class
+// Traced from begin to commit or abort, with the commit (the fsync) as a span of its own.
 class txn {
 private:
     MDB_txn* mdb_txn;
+    uint64_t started = 0;
 public:
     txn(MDB_env* env, MDB_txn* parent, MDB_dbi flags) {
+        if (trace::enabled()) started = trace::now_ns();
         if (auto rc = mdb_txn_begin(env, parent, flags, &mdb_txn)) throw exception("mdb_txn_begin", rc);
     }
-    ~txn() { if (mdb_txn) mdb_txn_commit(mdb_txn); } // auto-commit on destruction
-    void abort() { mdb_txn_abort(mdb_txn); mdb_txn = nullptr; }
+    ~txn() { // auto-commit on destruction
+        if (!mdb_txn) return;
+        uint64_t committing = trace::enabled() ? trace::now_ns() : 0;
+        mdb_txn_commit(mdb_txn);
+        if (started) {
+            uint64_t now = trace::now_ns();
+            trace::complete("lmdb_commit", "lmdb", committing, now);
+            trace::complete("lmdb_txn", "lmdb", started, now);
+        }
+    }
+    void abort() {
+        mdb_txn_abort(mdb_txn);
+        mdb_txn = nullptr;
+        if (started) trace::complete("lmdb_txn", "lmdb", started, trace::now_ns());
+    }
     operator MDB_txn*() { return mdb_txn; }
 };
 
+// Long-lived read-only transaction: begun once, then reset between uses and renewed, which
+// keeps its reader slot instead of taking a new one per call. Not tied to a thread when the
+// env is opened with MDB_NOTLS, but only one thread may use it at a time.
+class read_txn {
+private:
+    MDB_txn* mdb_txn = nullptr;
+    bool active = false;
+    uint64_t started = 0;
+public:
+    read_txn() = default;
+    read_txn(const read_txn&) = delete;
+    read_txn& operator=(const read_txn&) = delete;
+    ~read_txn() { if (mdb_txn) mdb_txn_abort(mdb_txn); }
+
+    MDB_txn* begin(MDB_env* env) {
+        if (!mdb_txn) {
+            if (auto rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &mdb_txn)) throw exception("mdb_txn_begin", rc);
+        } else if (!active) {
+            if (auto rc = mdb_txn_renew(mdb_txn)) throw exception("mdb_txn_renew", rc);
+        }
+        if (!active) started = trace::enabled() ? trace::now_ns() : 0;
+        active = true;
+        return mdb_txn;
+    }
+    // Releases the snapshot; pointers fetched under it are invalid afterwards.
+    void reset() {
+        if (mdb_txn && active) mdb_txn_reset(mdb_txn);
+        if (active && started) trace::complete("lmdb_read_txn", "lmdb", started, trace::now_ns());
+        active = false;
+    }
+    operator MDB_txn*() { return mdb_txn; }
+};
+
+// Cursor over one database, closed on destruction. Lives no longer than its transaction.
+class cursor {
+private:
+    MDB_cursor* mdb_cursor = nullptr;
+public:
+    cursor(MDB_txn* txn, MDB_dbi dbi) {
+        if (auto rc = mdb_cursor_open(txn, dbi, &mdb_cursor)) throw exception("mdb_cursor_open", rc);
+    }
+    cursor(const cursor&) = delete;
+    cursor& operator=(const cursor&) = delete;
+    ~cursor() { if (mdb_cursor) mdb_cursor_close(mdb_cursor); }
+
+    // False when there is no such entry (MDB_NOTFOUND); other errors throw.
+    bool get(MDB_val& key, MDB_val& data, MDB_cursor_op op) {
+        int rc = mdb_cursor_get(mdb_cursor, &key, &data, op);
+        if (rc == MDB_NOTFOUND) return false;
+        if (rc) throw exception("mdb_cursor_get", rc);
+        return true;
+    }
+    operator MDB_cursor*() { return mdb_cursor; }
+};
+
 // Database class
 class dbi {
 private:
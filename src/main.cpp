@@ -9,16 +9,29 @@
 #include <numeric>
 #include <chrono>
 #include <sstream>
+#include <memory>
+#include <cstdio>
 #include "lmdb++.h"
 #include "utils.hpp"
 #include "inference.hpp"
+#include "vocab.hpp"
+#include "server.hpp"
+#include "responses.hpp"
+#include "key_bitmap.hpp"
+#include "id_map.hpp"
+#include "distribution_cache.hpp"
+#include "memory_label.hpp"
+#include "instruction_index.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "hnswlib/hnswlib.h"
 
 using NextGivenCurrentCounts = std::unordered_map<uint32_t, std::unordered_map<uint32_t, uint64_t>>;
 using PrevGivenCurrentCounts = std::unordered_map<uint32_t, std::unordered_map<uint32_t, uint64_t>>;
 
-void trainModel(const std::string& corpusPath, const std::string& dbPath) {
+void trainModel(const std::string& corpusPath, const std::string& dbPath, bool remap_ids) {
     const int VECTOR_DIMENSION = 256;
+    const size_t HOT_CACHE_KEYS = 1 << 17; // most frequent table keys listed for the engine's distribution cache
     auto start_time = std::chrono::high_resolution_clock::now();
     std::cout << "Starting FMM model training (V4.2 - Unified BPE Model)..." << std::endl;
     std::ifstream corpusFile(corpusPath);
@@ -32,6 +45,8 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
     PrevGivenCurrentCounts p_prev_given_current_counts;
     std::string line;
     uint32_t max_id = 0;
+    std::vector<uint64_t> token_counts; // occurrences of each id, for frequency-ordered remapping
+    uint64_t phase_start = trace::now_ns();
     while (std::getline(corpusFile, line)) {
         std::stringstream ss(line);
         uint32_t id;
@@ -39,6 +54,8 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
         while(ss >> id) {
             id_tokens.push_back(id);
             if (id > max_id) max_id = id;
+            if (id >= token_counts.size()) token_counts.resize(static_cast<size_t>(id) + 1, 0);
+            token_counts[id]++;
         }
         if (id_tokens.size() < 2) continue;
         for (size_t i = 0; i < id_tokens.size() - 1; ++i) {
@@ -46,14 +63,30 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
             p_prev_given_current_counts[id_tokens[i+1]][id_tokens[i]]++;
         }
     }
+    trace::complete("count_statistics", "train", phase_start, trace::now_ns());
     std::cout << "Statistics built. Max token ID found: " << max_id << std::endl;
 
+    // Optionally renumber tokens by frequency: everything written below uses the model ids,
+    // and id_map.bin lets the engine translate at the tokenizer.
+    std::unique_ptr<IdMapWriter> id_map;
+    if (remap_ids) id_map.reset(new IdMapWriter(token_counts));
+    auto model_id = [&](uint32_t id) { return id_map ? id_map->to_model(id) : id; };
+
     try {
         std::string command = "mkdir -p " + dbPath;
         system(command.c_str());
         lmdb::env env = lmdb::env(dbPath.c_str(), MDB_WRITEMAP, 0664);
+        // State from an earlier model in the same directory would describe the wrong ids.
+        std::remove((dbPath + "/id_map.bin").c_str());
+        if (id_map) {
+            id_map->write(dbPath + "/id_map.bin");
+            std::cout << "Token ids remapped by frequency (id_map.bin)." << std::endl;
+        }
 
-        { 
+        DistributionKeysWriter distribution_keys; // which ids get a table entry, so inference can skip the rest
+        std::vector<std::pair<uint64_t, uint64_t>> key_counts; // (occurrences, cache key), to rank the hottest keys
+        {
+            FMM_TRACE_SPAN("train", "write_tables");
             lmdb::txn txn = lmdb::txn(env, nullptr, 0);
             lmdb::dbi p_next_dbi = lmdb::dbi(txn, "p_next_given_current", MDB_CREATE | MDB_INTEGERKEY);
             lmdb::dbi p_prev_dbi = lmdb::dbi(txn, "p_prev_given_current", MDB_CREATE | MDB_INTEGERKEY);
@@ -66,9 +99,12 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
                 std::vector<ProbEntry> dist;
                 dist.reserve(pair.second.size());
                 for (const auto& next_pair : pair.second) {
-                    dist.push_back({next_pair.first, static_cast<float>(next_pair.second) / total_count});
+                    dist.push_back({model_id(next_pair.first), static_cast<float>(next_pair.second) / total_count});
                 }
-                lmdb::put(txn, p_next_dbi, lmdb::val(pair.first), lmdb::val(dist));
+                uint32_t key = model_id(pair.first);
+                lmdb::put(txn, p_next_dbi, lmdb::val(key), lmdb::val(dist));
+                distribution_keys.add_next(key);
+                key_counts.push_back({total_count, DistributionCache::key_of(DistributionCache::NEXT, key)});
             }
             std::cout << "Writing reverse statistical distributions..." << std::endl;
             for (const auto& pair : p_prev_given_current_counts) {
@@ -78,12 +114,27 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
                 std::vector<ProbEntry> dist;
                 dist.reserve(pair.second.size());
                 for (const auto& prev_pair : pair.second) {
-                    dist.push_back({prev_pair.first, static_cast<float>(prev_pair.second) / total_count});
+                    dist.push_back({model_id(prev_pair.first), static_cast<float>(prev_pair.second) / total_count});
                 }
-                lmdb::put(txn, p_prev_dbi, lmdb::val(pair.first), lmdb::val(dist));
+                uint32_t key = model_id(pair.first);
+                lmdb::put(txn, p_prev_dbi, lmdb::val(key), lmdb::val(dist));
+                distribution_keys.add_prev(key);
+                key_counts.push_back({total_count, DistributionCache::key_of(DistributionCache::PREV, key)});
             }
             std::cout << "Statistical tables written." << std::endl;
         }
+        {
+            FMM_TRACE_SPAN("train", "write_key_files");
+            distribution_keys.write(dbPath + "/distribution_keys.bin");
+            // Lookups follow token frequency, so the most frequent keys are what the engine caches first.
+            std::sort(key_counts.begin(), key_counts.end(), [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
+                return a.first != b.first ? a.first > b.first : a.second < b.second;
+            });
+            if (key_counts.size() > HOT_CACHE_KEYS) key_counts.resize(HOT_CACHE_KEYS);
+            std::vector<uint64_t> hot_keys;
+            for (const auto& kc : key_counts) hot_keys.push_back(kc.second);
+            cache_key_file::write(dbPath + "/hot_tokens.bin", hot_keys);
+        }
 
         std::cout << "\n[Phase 2: Building Question-to-Answer Memory Bank]" << std::endl;
         hnswlib::L2Space space(VECTOR_DIMENSION);
@@ -92,10 +143,13 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
         corpusFile.seekg(0, std::ios::beg);
         uint64_t memory_idx = 0;
         std::vector<uint32_t> current_instruction_ids;
+        ResponseStoreWriter responses; // full response of every memory, for whole-response retrieval
+        InstructionIndexWriter instructions; // exact instruction -> outcome, checked before the ANN
         const uint32_t INSTRUCTION_ID = 3;
         const uint32_t RESPONSE_ID = 4;
 
         {
+            FMM_TRACE_SPAN("train", "build_memory_bank");
             lmdb::txn mem_txn(env, nullptr, 0);
             lmdb::dbi mem_dbi = lmdb::dbi(mem_txn, "memory_outcomes", MDB_CREATE | MDB_INTEGERKEY);
             while(std::getline(corpusFile, line)) {
@@ -104,16 +158,26 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
                 uint32_t id;
                 while(ss >> id) { id_tokens.push_back(id); }
                 if (id_tokens.empty()) continue;
-                if (id_tokens[0] == INSTRUCTION_ID) {
+                uint32_t marker = id_tokens[0]; // a tokenizer id, like INSTRUCTION_ID and RESPONSE_ID
+                if (id_map) id_map->to_model(id_tokens);
+                if (marker == INSTRUCTION_ID) {
                     current_instruction_ids = std::vector<uint32_t>(id_tokens.begin() + 1, id_tokens.end());
-                } else if (id_tokens[0] == RESPONSE_ID && !current_instruction_ids.empty() && id_tokens.size() > 1) {
+                } else if (marker == RESPONSE_ID && !current_instruction_ids.empty() && id_tokens.size() > 1) {
                     std::vector<float> vec(VECTOR_DIMENSION, 0.0f);
                     for(const auto& token_id : current_instruction_ids) {
                         vec[token_id % VECTOR_DIMENSION] += 1.0f;
                     }
-                    ann_index->addPoint(vec.data(), memory_idx);
                     uint32_t first_response_token_id = id_tokens[1];
+                    // Carry the outcome in the label so retrieval can vote without LMDB.
+                    uint64_t label = memory_label::can_pack(memory_idx, first_response_token_id)
+                        ? memory_label::pack(memory_idx, first_response_token_id) : memory_idx;
+                    {
+                        FMM_TRACE_SPAN("hnsw", "add_point");
+                        ann_index->addPoint(vec.data(), label);
+                    }
                     lmdb::put(mem_txn, mem_dbi, lmdb::val(memory_idx), lmdb::val(first_response_token_id));
+                    responses.append(id_tokens.data() + 1, id_tokens.size() - 1);
+                    instructions.add(current_instruction_ids.data(), current_instruction_ids.size(), first_response_token_id, memory_idx);
                     if (++memory_idx % 10000 == 0) {
                         std::cout << "Indexed " << memory_idx << " Q&A memories..." << std::endl;
                     }
@@ -122,46 +186,195 @@ void trainModel(const std::string& corpusPath, const std::string& dbPath) {
             }
         }
         std::cout << "Saving ANN index to disk..." << std::endl;
+        uint64_t write_start = trace::now_ns();
         ann_index->saveIndex(dbPath + "/ann_index.bin");
+        trace::complete("save_ann_index", "train", write_start, trace::now_ns());
+        std::cout << "Writing " << responses.size() << " memorized responses..." << std::endl;
+        write_start = trace::now_ns();
+        responses.write(dbPath + "/responses.bin");
+        trace::complete("write_responses", "train", write_start, trace::now_ns());
+        std::cout << "Writing exact-match index of " << instructions.size() << " distinct instructions..." << std::endl;
+        write_start = trace::now_ns();
+        instructions.write(dbPath + "/instructions.bin");
+        trace::complete("write_instructions", "train", write_start, trace::now_ns());
         delete ann_index;
     } catch (const std::exception& e) { std::cerr << "Error during training: " << e.what() << std::endl; }
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
     std::cout << "\nTraining complete in " << duration.count() << " seconds." << std::endl;
 }
+
+// --metrics=<file>: per-stage histograms and counters, written to <file> in Prometheus text
+// format on SIGUSR1 and again on exit.
+static void start_metrics(InferenceEngine& engine, const std::string& path) {
+    if (path.empty()) return;
+    engine.set_metrics_enabled(true);
+    metrics::dump_on_signal(path);
+    std::cout << "Metrics on; SIGUSR1 writes them to " << path << std::endl;
+}
+
+static void write_metrics(const std::string& path) {
+    if (path.empty()) return;
+    try {
+        metrics::write_prometheus(path);
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: could not write metrics: " << e.what() << std::endl;
+    }
+}
+
+// --trace=<file>: spans of every mode, written to <file> as Chrome trace-event JSON on exit.
+static void write_trace(const std::string& path) {
+    if (path.empty()) return;
+    try {
+        trace::write_json(path);
+        std::cerr << "Trace written to " << path << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Warning: could not write trace: " << e.what() << std::endl;
+    }
+}
+
+// --attention-window=<n>, --attention-decay=<d>: continuing-mode attention other than the
+// default whole, undecayed context. Reported, since it changes what the model predicts.
+// --attention-parallel-min=<n>: distinct context tokens from which one prediction's attention
+// uses all OpenMP threads (0 = never); scores are the same either way.
+static void configure_attention(InferenceEngine& engine, const AttentionConfig& cfg, bool given) {
+    if (!given) return;
+    engine.set_attention_config(cfg);
+    std::cerr << "Attention: window " << cfg.window << (cfg.window == 0 ? " (whole context)" : " tokens")
+              << ", decay " << cfg.decay << ", parallel from " << cfg.parallel_min_terms << " terms." << std::endl;
+}
+
 int main(int argc, char* argv[]) {
+    // Options may appear anywhere; what is left is positional.
+    std::string metrics_path, trace_path, warm_set_path;
+    AttentionConfig attention_cfg;
+    bool attention_given = false;
+    int num_args = 1;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 10, "--metrics=") == 0) metrics_path = arg.substr(10);
+            else if (arg.compare(0, 8, "--trace=") == 0) trace_path = arg.substr(8);
+            else if (arg.compare(0, 11, "--warm-set=") == 0) warm_set_path = arg.substr(11);
+            else if (arg.compare(0, 19, "--attention-window=") == 0) {
+                attention_cfg.window = std::stoul(arg.substr(19));
+                attention_given = true;
+            } else if (arg.compare(0, 18, "--attention-decay=") == 0) {
+                attention_cfg.decay = std::stof(arg.substr(18));
+                if (!(attention_cfg.decay > 0.0f && attention_cfg.decay <= 1.0f)) throw std::invalid_argument("decay");
+                attention_given = true;
+            } else if (arg.compare(0, 25, "--attention-parallel-min=") == 0) {
+                attention_cfg.parallel_min_terms = std::stoul(arg.substr(25));
+                attention_given = true;
+            } else argv[num_args++] = argv[i];
+        }
+    } catch (const std::exception&) {
+        std::cerr << "Error: --attention-window and --attention-parallel-min take a token count, --attention-decay a factor in (0, 1]." << std::endl;
+        return 1;
+    }
+    argc = num_args;
     if (argc < 4) {
-        std::cerr << "Usage: \n" << "  " << argv[0] << " train <path_to_corpus.txt> <path_to_db>\n" << "  " << argv[0] << " predict <path_to_db> <path_to_tokenizer.json>\n";
+        std::cerr << "Usage: \n" << "  " << argv[0] << " train <path_to_corpus.txt> <path_to_db> [remap]\n" << "  " << argv[0] << " predict <path_to_db> <path_to_tokenizer.json> [seed] [whole]\n" << "  " << argv[0] << " compile-vocab <path_to_tokenizer.json> <path_to_db>\n" << "  " << argv[0] << " batch <path_to_db> <path_to_tokenizer.json> <path_to_prompts.txt>\n" << "  " << argv[0] << " serve <path_to_db> <path_to_tokenizer.json> [unix:<path>|tcp:<port>] [max_active] [whole]\n" << "predict, batch and serve take --metrics=<file> to record per-stage latencies and counters,\n"
+                  << "and --warm-set=<file> to keep the distribution cache's contents there across restarts;\n"
+                  << "--attention-window=<n> and --attention-decay=<d> attend to the last n tokens only, each\n"
+                  << "weighted d per token of distance (default: the whole context, undecayed), and\n"
+                  << "--attention-parallel-min=<n> spreads a prediction over all threads from n distinct tokens (default 1024)\n"
+                  << "every mode takes --trace=<file> to write a Chrome trace (chrome://tracing, ui.perfetto.dev)\n";
         return 1;
     }
+    if (!trace_path.empty()) trace::enable(true);
     std::string mode = argv[1];
     if (mode == "train") {
-        trainModel(argv[2], argv[3]);
+        trainModel(argv[2], argv[3], argc > 4 && std::string(argv[4]) == "remap");
     } else if (mode == "predict") {
-        InferenceEngine engine(argv[2], argv[3]);
+        InferenceEngine engine(argv[2], argv[3], warm_set_path);
+        if (argc > 4) {
+            SamplerConfig sampler_cfg;
+            sampler_cfg.fixed_seed = true;
+            sampler_cfg.seed = std::stoull(argv[4]);
+            engine.set_sampler_config(sampler_cfg);
+        }
+        configure_attention(engine, attention_cfg, attention_given);
+        start_metrics(engine, metrics_path);
         std::cout << "\n--- FMM Chatbot Initialized (Unified Model v4.2) ---" << std::endl;
         std::cout << "Enter your prompt. Type '[EXIT]' to quit." << std::endl;
+        GenerationOptions gen_options; // 80 tokens, stop on any bracketed token
+        gen_options.whole_response = argc > 5 && std::string(argv[5]) == "whole";
         std::string prompt;
         while (true) {
             std::cout << "\n> ";
             std::getline(std::cin, prompt);
             if (prompt == "[EXIT]") { break; }
-            std::string current_context = prompt;
             std::cout << ">> " << prompt;
-            current_context += " [RESPONSE]";
-            for (int i = 0; i < 80; ++i) {
-                std::string prediction = engine.predict_next_token(current_context);
-                if (prediction == "[STOP]" || prediction.find('[') != std::string::npos || prediction.empty()) {
-                    break;
-                }
-                std::cout << prediction << std::flush;
-                current_context += prediction;
-            }
+            engine.generate(prompt, gen_options, [&](uint32_t token_id) {
+                std::cout << engine.token_view(token_id) << std::flush;
+                return true;
+            });
             std::cout << std::endl;
         }
+        write_metrics(metrics_path);
+    } else if (mode == "batch") {
+        if (argc < 5) {
+            std::cerr << "Error: batch mode needs a prompts file." << std::endl;
+            return 1;
+        }
+        std::ifstream promptFile(argv[4]);
+        if (!promptFile.is_open()) {
+            std::cerr << "Error: Could not open prompts file at " << argv[4] << std::endl;
+            return 1;
+        }
+        InferenceEngine engine(argv[2], argv[3], warm_set_path);
+        configure_attention(engine, attention_cfg, attention_given);
+        start_metrics(engine, metrics_path);
+        std::vector<InferenceEngine::Context> prompts;
+        std::string line;
+        while (std::getline(promptFile, line)) prompts.push_back(line);
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<uint32_t> predictions(prompts.size());
+        engine.predict_batch(prompts.data(), prompts.size(), predictions.data());
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time);
+        for (uint32_t prediction : predictions) std::cout << engine.prediction_view(prediction) << "\n";
+        std::cerr << "Scored " << prompts.size() << " prompts in " << duration.count() << " ms (retrieval cache hit rate "
+                  << 100.0 * engine.retrieval_cache_hit_rate() << "%, distribution cache hit rate "
+                  << 100.0 * engine.distribution_cache_hit_rate() << "%)." << std::endl;
+        write_metrics(metrics_path);
+    } else if (mode == "serve") {
+        ServerConfig server_cfg;
+        if (argc > 4) server_cfg.address = argv[4];
+        if (argc > 5) server_cfg.max_active = std::stoul(argv[5]);
+        server_cfg.whole_response = argc > 6 && std::string(argv[6]) == "whole";
+        InferenceEngine engine(argv[2], argv[3], warm_set_path);
+        configure_attention(engine, attention_cfg, attention_given);
+        start_metrics(engine, metrics_path);
+        try {
+            Server server(engine, server_cfg);
+            server.run();
+            std::cout << "Retrieval cache: " << engine.retrieval_cache_hits() << " hits, " << engine.retrieval_cache_misses()
+                      << " misses (" << 100.0 * engine.retrieval_cache_hit_rate() << "%)." << std::endl;
+            std::cout << "Distribution cache: " << engine.distribution_cache_hits() << " hits, " << engine.distribution_cache_misses()
+                      << " misses (" << 100.0 * engine.distribution_cache_hit_rate() << "%), "
+                      << engine.distribution_cache_bytes() / 1024 << " KB." << std::endl;
+            if (engine.prefix_cache_enabled()) {
+                std::cout << "Prefix cache: " << engine.prefix_cache_hits() << " hits, " << engine.prefix_cache_misses()
+                          << " misses, " << engine.prefix_cache_bytes() / 1024 << " KB." << std::endl;
+            }
+            write_metrics(metrics_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    } else if (mode == "compile-vocab") {
+        try {
+            compile_vocab_from_tokenizer(argv[2], std::string(argv[3]) + "/vocab.bin");
+            BpeEncoder::compile(argv[2], std::string(argv[3]) + "/bpe.bin");
+        } catch (const std::exception& e) {
+            std::cerr << "Error compiling vocabulary: " << e.what() << std::endl;
+            return 1;
+        }
     } else {
         std::cerr << "Error: Unknown mode '" << mode << "'." << std::endl;
         return 1;
     }
+    write_trace(trace_path);
     return 0;
 }
\ No newline at end of file
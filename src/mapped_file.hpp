@@ -0,0 +1,111 @@
+// src/mapped_file.hpp (Read-only mmap of a whole file, and replacing one in place)
+
+#ifndef FMM_MAPPED_FILE_HPP
+#define FMM_MAPPED_FILE_HPP
+
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maps a file PROT_READ / MAP_SHARED so its pages come straight from the page cache
+// and are shared by every process that maps the same file.
+class MappedFile {
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+
+    void unmap() {
+        if (base) munmap(const_cast<char*>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) { open(path); }
+    ~MappedFile() { unmap(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept : base(other.base), length(other.length) {
+        other.base = nullptr;
+        other.length = 0;
+    }
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            base = other.base;
+            length = other.length;
+            other.base = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    void open(const std::string& path) {
+        unmap();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("open " + path + ": " + std::strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error("fstat " + path + ": " + std::strerror(err));
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                length = 0;
+                throw std::runtime_error("mmap " + path + ": " + std::strerror(err));
+            }
+            base = static_cast<const char*>(p);
+        }
+        ::close(fd); // the mapping keeps its own reference
+    }
+
+    bool is_open() const { return base != nullptr; }
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// A name beside `path` that no other process or call uses: <path>.tmp.<pid>.<serial>.
+inline std::string unique_tmp_path(const std::string& path) {
+    static std::atomic<uint64_t> serial{0};
+    return path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(serial.fetch_add(1));
+}
+
+// Writes a file through write(std::ofstream&) into a temporary beside it and renames that
+// over outPath, so a reader opening or mapping the file meanwhile sees the old one or the
+// new one, never half of it. Writers racing on one path each have their own temporary; the
+// last rename wins.
+template<typename F>
+void replace_file(const std::string& outPath, F&& write) {
+    std::string tmpPath = unique_tmp_path(outPath);
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Could not open " + tmpPath + " for writing");
+    write(out);
+    out.close();
+    if (!out) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Failed writing " + tmpPath);
+    }
+    if (std::rename(tmpPath.c_str(), outPath.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Could not rename " + tmpPath);
+    }
+}
+
+#endif // FMM_MAPPED_FILE_HPP
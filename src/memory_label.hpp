@@ -0,0 +1,33 @@
+// src/memory_label.hpp (ANN labels that carry a memory's first response token)
+
+#ifndef FMM_MEMORY_LABEL_HPP
+#define FMM_MEMORY_LABEL_HPP
+
+#include <cstdint>
+
+// A packed label is  1 | outcome_id (31 bits) | memory_idx (32 bits),  so scoring a
+// neighbour needs no memory_outcomes lookup. Indexes written before packing have the top
+// bit clear and their label is the bare memory index.
+namespace memory_label {
+
+const uint64_t PACKED_BIT = 1ULL << 63;
+const uint64_t MAX_MEMORY_IDX = 0xFFFFFFFFULL;
+const uint32_t MAX_OUTCOME_ID = 0x7FFFFFFFu;
+
+inline bool can_pack(uint64_t memory_idx, uint32_t outcome_id) {
+    return memory_idx <= MAX_MEMORY_IDX && outcome_id <= MAX_OUTCOME_ID;
+}
+
+inline uint64_t pack(uint64_t memory_idx, uint32_t outcome_id) {
+    return PACKED_BIT | (static_cast<uint64_t>(outcome_id) << 32) | memory_idx;
+}
+
+inline bool is_packed(uint64_t label) { return (label & PACKED_BIT) != 0; }
+
+inline uint64_t memory_idx(uint64_t label) { return is_packed(label) ? (label & MAX_MEMORY_IDX) : label; }
+
+inline uint32_t outcome_id(uint64_t label) { return static_cast<uint32_t>(label >> 32) & MAX_OUTCOME_ID; }
+
+} // namespace memory_label
+
+#endif // FMM_MEMORY_LABEL_HPP
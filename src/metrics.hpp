@@ -0,0 +1,355 @@
+// src/metrics.hpp (Per-thread stage latency histograms and counters, with Prometheus text export)
+
+#ifndef FMM_METRICS_HPP
+#define FMM_METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include "mapped_file.hpp"
+#include "trace.hpp"
+
+// Off by default; while off, every hook below is one relaxed load and a branch. While on,
+// each thread records into its own block with plain relaxed stores, so instrumented code
+// never contends on a cache line. A snapshot sums the blocks of all threads, past and present.
+namespace metrics {
+
+enum Stage { TOKENIZE, VOCAB_LOOKUP, LMDB_FETCH, ANN_SEARCH, ATTENTION, TOP_K, SAMPLE, NUM_STAGES };
+enum Counter { PREDICTIONS, LMDB_READS, LMDB_MISSES, ANN_HOPS, ANN_DISTANCES, NUM_COUNTERS };
+
+inline const char* stage_name(Stage stage) {
+    static const char* const NAMES[NUM_STAGES] = {"tokenize", "vocab_lookup", "lmdb_fetch", "ann_search", "attention", "top_k", "sample"};
+    return NAMES[stage];
+}
+
+// Prometheus metric names; LMDB_MISSES are lookups of keys the table does not hold.
+inline const char* counter_name(Counter counter) {
+    static const char* const NAMES[NUM_COUNTERS] = {"fmm_predictions_total", "fmm_lmdb_reads_total", "fmm_lmdb_misses_total",
+                                                    "fmm_ann_hops_total", "fmm_ann_distance_computations_total"};
+    return NAMES[counter];
+}
+
+// Log-linear buckets in the manner of HdrHistogram: each power of two of nanoseconds is split
+// into SUB_BUCKETS linear steps, so a bucket's bounds are within 1/8 of any value in it.
+// Values below SUB_BUCKETS ns get a bucket each; values from 2^MAX_EXPONENT ns (about 18
+// minutes) on share the last one.
+const int SUB_BUCKET_BITS = 3;
+const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+const int MAX_EXPONENT = 40;
+const int NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+inline int bucket_of(uint64_t ns) {
+    if (ns < static_cast<uint64_t>(SUB_BUCKETS)) return static_cast<int>(ns);
+    int exponent = 63 - __builtin_clzll(ns);
+    if (exponent >= MAX_EXPONENT) return NUM_BUCKETS - 1;
+    int sub = static_cast<int>(ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// Exclusive upper bound of a bucket, in ns.
+inline uint64_t bucket_upper(int bucket) {
+    if (bucket < SUB_BUCKETS) return static_cast<uint64_t>(bucket) + 1;
+    int exponent = bucket / SUB_BUCKETS - 1 + SUB_BUCKET_BITS;
+    uint64_t sub = static_cast<uint64_t>(bucket % SUB_BUCKETS);
+    return (SUB_BUCKETS + sub + 1) << (exponent - SUB_BUCKET_BITS);
+}
+
+struct HistogramSnapshot {
+    uint64_t buckets[NUM_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    double mean_ns() const { return count ? static_cast<double>(sum_ns) / count : 0.0; }
+
+    // Upper bound of the bucket holding the q-quantile (0 <= q <= 1), in ns; 0 when empty.
+    uint64_t percentile_ns(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1, seen = 0;
+        for (int b = 0; b < NUM_BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen >= rank) return bucket_upper(b);
+        }
+        return bucket_upper(NUM_BUCKETS - 1);
+    }
+};
+
+struct Snapshot {
+    HistogramSnapshot stages[NUM_STAGES];
+    uint64_t counters[NUM_COUNTERS] = {};
+};
+
+namespace detail {
+
+struct ThreadBlock {
+    std::atomic<uint64_t> buckets[NUM_STAGES][NUM_BUCKETS];
+    std::atomic<uint64_t> sum_ns[NUM_STAGES];
+    std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+    ThreadBlock() { clear(); }
+    void clear() {
+        for (auto& stage : buckets) for (auto& b : stage) b.store(0, std::memory_order_relaxed);
+        for (auto& s : sum_ns) s.store(0, std::memory_order_relaxed);
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Only the owning thread writes a block, so a load and a store stand in for a locked add.
+inline void bump(std::atomic<uint64_t>& slot, uint64_t n) {
+    slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Every block ever handed out. A thread's block goes back to the free list when the thread
+// exits, its counts intact, and the next new thread continues it.
+class Registry {
+public:
+    ThreadBlock* acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!free_blocks.empty()) {
+            ThreadBlock* block = free_blocks.back();
+            free_blocks.pop_back();
+            return block;
+        }
+        blocks.emplace_back(new ThreadBlock());
+        return blocks.back().get();
+    }
+    void release(ThreadBlock* block) {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_blocks.push_back(block);
+    }
+
+    void snapshot(Snapshot& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& block : blocks) {
+            for (int s = 0; s < NUM_STAGES; ++s) {
+                HistogramSnapshot& h = out.stages[s];
+                for (int b = 0; b < NUM_BUCKETS; ++b) {
+                    uint64_t n = block->buckets[s][b].load(std::memory_order_relaxed);
+                    h.buckets[b] += n;
+                    h.count += n;
+                }
+                h.sum_ns += block->sum_ns[s].load(std::memory_order_relaxed);
+            }
+            for (int c = 0; c < NUM_COUNTERS; ++c) out.counters[c] += block->counters[c].load(std::memory_order_relaxed);
+        }
+        for (const auto& collector : collectors) collector.second(out);
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& block : blocks) block->clear();
+    }
+
+    void add_collector(const void* owner, std::function<void(Snapshot&)> fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectors.emplace_back(owner, std::move(fn));
+    }
+    void remove_collector(const void* owner) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = collectors.size(); i-- > 0;) {
+            if (collectors[i].first == owner) collectors.erase(collectors.begin() + i);
+        }
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBlock>> blocks;
+    std::vector<ThreadBlock*> free_blocks;
+    std::vector<std::pair<const void*, std::function<void(Snapshot&)>>> collectors;
+};
+
+// Never destroyed: threads (OpenMP workers among them) may exit after static destructors ran.
+inline Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+inline std::atomic<bool>& enabled_flag() {
+    static std::atomic<bool> flag{false};
+    return flag;
+}
+
+struct ThreadHandle {
+    ThreadBlock* block = nullptr;
+    ~ThreadHandle() { if (block) registry().release(block); }
+};
+
+inline ThreadBlock& local() {
+    thread_local ThreadHandle handle;
+    if (!handle.block) handle.block = registry().acquire();
+    return *handle.block;
+}
+
+} // namespace detail
+
+inline bool enabled() { return detail::enabled_flag().load(std::memory_order_relaxed); }
+inline void enable(bool on) { detail::enabled_flag().store(on, std::memory_order_relaxed); }
+
+inline void add(Counter counter, uint64_t n = 1) {
+    if (enabled()) detail::bump(detail::local().counters[counter], n);
+}
+
+inline void record(Stage stage, uint64_t ns) {
+    if (!enabled()) return;
+    detail::ThreadBlock& block = detail::local();
+    detail::bump(block.buckets[stage][bucket_of(ns)], 1);
+    detail::bump(block.sum_ns[stage], ns);
+}
+
+// Times a scope as one stage; next() closes the current stage and opens another with a
+// single clock read. Each stage is also a trace span while tracing is on. Inert if both
+// metrics and tracing were off when it was created.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage(stage), active(enabled() || trace::enabled()) {
+        if (active) start = trace::now_ns();
+    }
+    ~StageTimer() { stop(); }
+
+    void next(Stage following) {
+        if (!active) return;
+        uint64_t now = trace::now_ns();
+        finish(now);
+        stage = following;
+        start = now;
+    }
+
+    void stop() {
+        if (!active) return;
+        finish(trace::now_ns());
+        active = false;
+    }
+
+private:
+    void finish(uint64_t now) const {
+        record(stage, now - start);
+        trace::complete(stage_name(stage), "stage", start, now);
+    }
+
+    Stage stage;
+    bool active;
+    uint64_t start = 0;
+};
+
+inline Snapshot snapshot() {
+    Snapshot out;
+    detail::registry().snapshot(out);
+    return out;
+}
+
+inline void reset() { detail::registry().reset(); }
+
+// Sources of counts kept outside the per-thread blocks (the ANN index's own counters); each
+// runs on every snapshot. Remove them before `owner` goes away.
+inline void add_collector(const void* owner, std::function<void(Snapshot&)> fn) { detail::registry().add_collector(owner, std::move(fn)); }
+inline void remove_collector(const void* owner) { detail::registry().remove_collector(owner); }
+
+// Prometheus text exposition format. Histogram buckets are cut at powers of two of
+// nanoseconds, which are bucket bounds, so the cumulative counts are exact.
+inline std::string prometheus_text(const Snapshot& snap) {
+    const int FIRST_EDGE = 8, LAST_EDGE = 34; // 256 ns .. ~17 s
+    std::ostringstream out;
+    char value[32];
+    out << "# HELP fmm_stage_seconds Time spent in each inference stage.\n# TYPE fmm_stage_seconds histogram\n";
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        const HistogramSnapshot& h = snap.stages[s];
+        const char* name = stage_name(static_cast<Stage>(s));
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (int e = FIRST_EDGE; e <= LAST_EDGE; ++e) {
+            uint64_t edge = 1ULL << e;
+            for (; b < NUM_BUCKETS && bucket_upper(b) <= edge; ++b) cumulative += h.buckets[b];
+            std::snprintf(value, sizeof(value), "%.9g", edge * 1e-9);
+            out << "fmm_stage_seconds_bucket{stage=\"" << name << "\",le=\"" << value << "\"} " << cumulative << "\n";
+        }
+        out << "fmm_stage_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << h.count << "\n";
+        std::snprintf(value, sizeof(value), "%.9g", h.sum_ns * 1e-9);
+        out << "fmm_stage_seconds_sum{stage=\"" << name << "\"} " << value << "\n";
+        out << "fmm_stage_seconds_count{stage=\"" << name << "\"} " << h.count << "\n";
+    }
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        const char* name = counter_name(static_cast<Counter>(c));
+        out << "# TYPE " << name << " counter\n" << name << " " << snap.counters[c] << "\n";
+    }
+    return out.str();
+}
+
+inline void write_prometheus(const std::string& outPath) {
+    std::string text = prometheus_text(snapshot());
+    replace_file(outPath, [&](std::ofstream& out) { out << text; });
+}
+
+namespace detail {
+
+inline volatile std::sig_atomic_t& dump_requested() {
+    static volatile std::sig_atomic_t flag = 0;
+    return flag;
+}
+
+inline void on_dump_signal(int) { dump_requested() = 1; }
+
+// Writing a file is not async-signal-safe, so the handler only raises a flag and this
+// thread, polling it, does the write.
+class DumpWatcher {
+public:
+    ~DumpWatcher() { stop(); }
+
+    void start(const std::string& path) {
+        stop();
+        this->path = path;
+        running = true;
+        thread = std::thread([this] {
+            while (running.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (!dump_requested()) continue;
+                dump_requested() = 0;
+                try {
+                    write_prometheus(this->path);
+                } catch (const std::exception&) {
+                    // Nowhere to report from here; the next signal tries again.
+                }
+            }
+        });
+    }
+
+    void stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
+
+private:
+    std::string path;
+    std::atomic<bool> running{false};
+    std::thread thread;
+};
+
+inline DumpWatcher& dump_watcher() {
+    static DumpWatcher watcher;
+    return watcher;
+}
+
+} // namespace detail
+
+// Writes the Prometheus text to `path` whenever the process receives `signum`, e.g.
+// `kill -USR1 <pid>`.
+inline void dump_on_signal(const std::string& path, int signum = SIGUSR1) {
+    detail::dump_watcher().start(path);
+    struct sigaction action = {};
+    action.sa_handler = detail::on_dump_signal;
+    sigaction(signum, &action, nullptr);
+}
+
+} // namespace metrics
+
+#endif // FMM_METRICS_HPP
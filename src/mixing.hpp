@@ -0,0 +1,85 @@
+// src/mixing.hpp (Scatter-add kernels that mix sparse distributions into a dense score vector)
+
+#ifndef FMM_MIXING_HPP
+#define FMM_MIXING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "utils.hpp" // ProbEntry
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace mixing {
+
+// score + scale * probability, rounded the way the vector kernels below round it: fused on
+// FMA targets, so every path that mixes into a score (the scalar tail, the vector lanes, the
+// parallel reduction in accumulate_attention) produces the same bits regardless of how the
+// compiler contracts plain arithmetic.
+inline float mix(float score, float scale, float probability) {
+#if defined(__FMA__) || defined(__AVX512F__)
+    return std::fma(scale, probability, score);
+#else
+    return score + scale * probability;
+#endif
+}
+
+// scores[e.token_id] += scale * e.probability for each entry, one at a time.
+inline void scatter_add_scalar(float* scores, const ProbEntry* entries, size_t n, float scale) {
+    for (size_t i = 0; i < n; ++i) scores[entries[i].token_id] = mix(scores[entries[i].token_id], scale, entries[i].probability);
+}
+
+// Same sums as scatter_add_scalar: lanes fuse the multiply-add exactly where mix() does. Token ids within one distribution must be
+// distinct (the trainer writes one entry per id): the vector paths gather a register of
+// scores, add, and store them back, so a repeated id would lose an add.
+//
+// Entries are stored interleaved, {id, probability} pairs. Each register load is split into an
+// id vector and a probability vector with shuffles, so the table needs no separate arrays.
+// AVX-512 scatters 16 sums at once. AVX2 has no scatter, so it gathers and adds 8 lanes and
+// stores them one by one.
+inline void scatter_add(float* scores, const ProbEntry* entries, size_t n, float scale) {
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    const __m512 s = _mm512_set1_ps(scale);
+    // The masked gather with a zeroed source does what the plain one does, but gives GCC no
+    // uninitialized pass-through register to warn about.
+    const __m512 zero = _mm512_setzero_ps();
+    const __mmask16 all = 0xFFFF;
+    for (; i + 16 <= n; i += 16) {
+        __m512i lo = _mm512_loadu_si512(entries + i);
+        __m512i hi = _mm512_loadu_si512(entries + i + 8);
+        __m512i ids = _mm512_permutex2var_epi32(lo, even, hi);
+        __m512 probs = _mm512_castsi512_ps(_mm512_permutex2var_epi32(lo, odd, hi));
+        __m512 sums = _mm512_fmadd_ps(s, probs, _mm512_mask_i32gather_ps(zero, all, ids, scores, 4));
+        _mm512_i32scatter_ps(scores, ids, sums, 4);
+    }
+#elif defined(__AVX2__)
+    const __m256 s = _mm256_set1_ps(scale);
+    alignas(32) uint32_t id_lanes[8];
+    alignas(32) float sum_lanes[8];
+    for (; i + 8 <= n; i += 8) {
+        __m256 lo = _mm256_loadu_ps(reinterpret_cast<const float*>(entries + i));
+        __m256 hi = _mm256_loadu_ps(reinterpret_cast<const float*>(entries + i + 4));
+        // In-lane shuffles give ids 0 1 4 5 | 2 3 6 7; the 64-bit permute restores the order.
+        __m256i ids = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 probs = _mm256_castsi256_ps(_mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+#if defined(__FMA__)
+        __m256 sums = _mm256_fmadd_ps(s, probs, _mm256_i32gather_ps(scores, ids, 4));
+#else
+        __m256 sums = _mm256_add_ps(_mm256_i32gather_ps(scores, ids, 4), _mm256_mul_ps(s, probs));
+#endif
+        _mm256_store_si256(reinterpret_cast<__m256i*>(id_lanes), ids);
+        _mm256_store_ps(sum_lanes, sums);
+        for (int k = 0; k < 8; ++k) scores[id_lanes[k]] = sum_lanes[k];
+    }
+#endif
+    scatter_add_scalar(scores, entries + i, n - i, scale);
+}
+
+} // namespace mixing
+
+#endif // FMM_MIXING_HPP
@@ -0,0 +1,210 @@
+// src/prefix_cache.hpp (Trie of shared context prefixes and their precomputed attention state)
+
+#ifndef FMM_PREFIX_CACHE_HPP
+#define FMM_PREFIX_CACHE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "attention.hpp"
+#include "distribution_cache.hpp"
+
+// What a continuing step needs from ids[0, length) of its context, computed once for every
+// session that starts with them. Immutable once built: sessions share it through
+// PrefixHandle and keep their own tokens after it, so nothing is ever copied on write.
+// Only valid for undecayed attention over the whole context, where a prefix token's weight
+// is its multiplicity no matter how far the context has grown.
+struct PrefixState {
+    std::vector<uint32_t> ids;        // the prefix
+    std::vector<AttentionTerm> terms; // ids merged by multiplicity, sorted by token id
+    std::vector<CachedEntries> next;  // terms[i]'s p_next; null when it has none
+    size_t bytes = 0;
+
+    // Index of token_id's term, or terms.size().
+    size_t find(uint32_t token_id) const {
+        auto it = std::lower_bound(terms.begin(), terms.end(), token_id,
+                                   [](const AttentionTerm& t, uint32_t id) { return t.token_id < id; });
+        return (it != terms.end() && it->token_id == token_id) ? it - terms.begin() : terms.size();
+    }
+};
+using PrefixHandle = std::shared_ptr<const PrefixState>;
+
+// A trie over the token ids of the contexts sessions started with. Paths are recorded for
+// every context; a state is built where two contexts share at least min_length tokens, or
+// one repeats, so a common system prompt gets a state after its second session without
+// anyone naming it. Bounded by bytes (trie nodes plus states) with least recently used
+// leaves evicted first; a state a session still holds is never evicted. Leaves are kept
+// ordered by last use, so an eviction costs a lookup rather than a pass over the trie.
+// Internally locked.
+class PrefixCache {
+public:
+    static constexpr size_t NODE_OVERHEAD = 80; // a Node plus its edge in `children`, roughly
+
+    // budget_bytes 0 disables the cache. Drops everything cached so far.
+    void configure(size_t budget_bytes, size_t min_length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = budget_bytes;
+        this->min_length = min_length > 0 ? min_length : 1;
+        nodes.assign(1, Node());
+        free_nodes.clear();
+        children.clear();
+        leaves.clear();
+        used = 0;
+        hit_count = 0;
+        miss_count = 0;
+    }
+
+    bool enabled() const { return budget > 0; }
+    size_t min_prefix_length() const { return min_length; }
+
+    // Walks ids[0, n) as far as recorded paths go. Returns the matched length; `longest`
+    // receives the state of the deepest matched node that has one (null if none does).
+    size_t match(const uint32_t* ids, size_t n, PrefixHandle& longest) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t now = ++tick;
+        longest = nullptr;
+        uint32_t node = 0;
+        size_t depth = 0;
+        for (; depth < n; ++depth) {
+            auto it = children.find(edge(node, ids[depth]));
+            if (it == children.end()) break;
+            node = it->second;
+            touch(node, now);
+            if (nodes[node].state) longest = nodes[node].state;
+        }
+        (longest ? hit_count : miss_count).fetch_add(1, std::memory_order_relaxed);
+        return depth;
+    }
+
+    // Records the path ids[0, n) for later contexts to match against.
+    void record(const uint32_t* ids, size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        extend(ids, n, ++tick);
+        evict();
+    }
+
+    // Attaches `state` to the node of state->ids, unless another thread got there first.
+    void insert(const PrefixHandle& state) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t node = extend(state->ids.data(), state->ids.size(), ++tick);
+        if (nodes[node].state) return;
+        nodes[node].state = state;
+        used += state->bytes;
+        evict();
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        uint32_t parent = 0;
+        uint32_t token_id = 0;
+        uint32_t num_children = 0;
+        uint64_t last_used = 0;
+        PrefixHandle state;
+    };
+
+    static uint64_t edge(uint32_t parent, uint32_t token_id) { return (static_cast<uint64_t>(parent) << 32) | token_id; }
+
+    // Marks a node used at `now`, moving it within `leaves` if it is one.
+    void touch(uint32_t node, uint64_t now) {
+        Node& n = nodes[node];
+        if (n.num_children == 0) {
+            leaves.erase({n.last_used, node});
+            leaves.insert({now, node});
+        }
+        n.last_used = now;
+    }
+
+    // Creates whatever part of the path is missing; returns its last node.
+    uint32_t extend(const uint32_t* ids, size_t n, uint64_t now) {
+        uint32_t node = 0;
+        for (size_t depth = 0; depth < n; ++depth) {
+            auto it = children.find(edge(node, ids[depth]));
+            uint32_t child;
+            if (it != children.end()) {
+                child = it->second;
+            } else {
+                if (free_nodes.empty()) {
+                    child = static_cast<uint32_t>(nodes.size());
+                    nodes.emplace_back();
+                } else {
+                    child = free_nodes.back();
+                    free_nodes.pop_back();
+                    nodes[child] = Node();
+                }
+                nodes[child].parent = node;
+                nodes[child].token_id = ids[depth];
+                nodes[child].last_used = now;
+                if (node != 0 && nodes[node].num_children == 0) leaves.erase({nodes[node].last_used, node});
+                nodes[node].num_children++;
+                children[edge(node, ids[depth])] = child;
+                leaves.insert({now, child});
+                used += NODE_OVERHEAD;
+            }
+            touch(child, now);
+            node = child;
+        }
+        return node;
+    }
+
+    void remove(uint32_t node) {
+        Node& n = nodes[node];
+        if (n.state) used -= n.state->bytes;
+        used -= NODE_OVERHEAD;
+        leaves.erase({n.last_used, node});
+        children.erase(edge(n.parent, n.token_id));
+        Node& parent = nodes[n.parent];
+        if (--parent.num_children == 0 && n.parent != 0) leaves.insert({parent.last_used, n.parent});
+        n.state = nullptr;
+        free_nodes.push_back(node);
+    }
+
+    // Drops least recently used leaves until within budget, each with the chain of bare
+    // ancestors only it kept alive. States held by a session (use_count > 1) stay.
+    void evict() {
+        while (used > budget) {
+            uint32_t victim = 0;
+            for (const auto& leaf : leaves) {
+                const Node& n = nodes[leaf.second];
+                if (n.state && n.state.use_count() > 1) continue; // only as many as sessions running
+                victim = leaf.second;
+                break;
+            }
+            if (victim == 0) return;
+            uint32_t parent = nodes[victim].parent;
+            remove(victim);
+            while (parent != 0 && nodes[parent].num_children == 0 && !nodes[parent].state) {
+                uint32_t up = nodes[parent].parent;
+                remove(parent);
+                parent = up;
+            }
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::vector<Node> nodes{Node()}; // nodes[0] is the root, the empty prefix
+    std::vector<uint32_t> free_nodes;
+    std::unordered_map<uint64_t, uint32_t> children; // edge(parent, token id) -> child
+    std::set<std::pair<uint64_t, uint32_t>> leaves;  // (last_used, node) of every live leaf but the root
+    size_t budget = 0;
+    size_t min_length = 1;
+    size_t used = 0;
+    uint64_t tick = 0;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+};
+
+#endif // FMM_PREFIX_CACHE_HPP
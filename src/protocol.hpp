@@ -0,0 +1,124 @@
+// src/protocol.hpp (Length-prefixed wire format and socket helpers for `fmm serve`)
+//
+// Request:  u32 prompt_length, u32 max_tokens, prompt bytes
+// Response: u32 text_length,   u32 num_tokens, completion bytes
+// All integers are big-endian. A connection may carry any number of requests, one at a time.
+
+#ifndef FMM_PROTOCOL_HPP
+#define FMM_PROTOCOL_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace protocol {
+
+const uint32_t MAX_FRAME_BYTES = 16u << 20;
+
+inline bool read_exact(int fd, void* buf, size_t n) {
+    char* p = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+inline bool write_all(int fd, const void* buf, size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+// One frame: a length, a 32-bit field, then `length` bytes of text. Returns false on EOF,
+// I/O error or an oversized frame.
+inline bool read_frame(int fd, std::string& text, uint32_t& field) {
+    uint32_t header[2];
+    if (!read_exact(fd, header, sizeof(header))) return false;
+    uint32_t length = ntohl(header[0]);
+    field = ntohl(header[1]);
+    if (length > MAX_FRAME_BYTES) return false;
+    text.resize(length);
+    return length == 0 || read_exact(fd, &text[0], length);
+}
+
+inline bool write_frame(int fd, const std::string& text, uint32_t field) {
+    std::string frame(2 * sizeof(uint32_t) + text.size(), '\0');
+    uint32_t header[2] = {htonl(static_cast<uint32_t>(text.size())), htonl(field)};
+    std::memcpy(&frame[0], header, sizeof(header));
+    std::memcpy(&frame[sizeof(header)], text.data(), text.size());
+    return write_all(fd, frame.data(), frame.size());
+}
+
+// Addresses are "unix:<path>" or "tcp:<port>" (always bound to 127.0.0.1).
+inline bool is_unix_address(const std::string& address) { return address.compare(0, 5, "unix:") == 0; }
+
+inline int open_socket(const std::string& address, bool listening) {
+    int fd = -1;
+    int rc = -1;
+    if (is_unix_address(address)) {
+        std::string path = address.substr(5);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Invalid unix socket path: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("socket() failed: " + std::string(std::strerror(errno)));
+        if (listening) {
+            ::unlink(path.c_str());
+            rc = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        } else {
+            rc = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+    } else if (address.compare(0, 4, "tcp:") == 0) {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(std::stoi(address.substr(4))));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("socket() failed: " + std::string(std::strerror(errno)));
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (listening) {
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            rc = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        } else {
+            rc = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+    } else {
+        throw std::runtime_error("Unknown address '" + address + "', expected unix:<path> or tcp:<port>");
+    }
+    if (rc == 0 && listening) rc = ::listen(fd, 128);
+    if (rc != 0) {
+        std::string err = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error((listening ? "Could not listen on " : "Could not connect to ") + address + ": " + err);
+    }
+    return fd;
+}
+
+inline int listen_on(const std::string& address) { return open_socket(address, true); }
+inline int connect_to(const std::string& address) { return open_socket(address, false); }
+
+} // namespace protocol
+
+#endif // FMM_PROTOCOL_HPP
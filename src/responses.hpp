@@ -0,0 +1,97 @@
+// src/responses.hpp (Packed, mmap-loaded store of every memory's full response)
+
+#ifndef FMM_RESPONSES_HPP
+#define FMM_RESPONSES_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// On-disk layout of responses.bin (all fields native-endian):
+//   ResponseFileHeader
+//   uint64_t offsets[num_memories + 1]   memory idx -> [offsets[i], offsets[i+1]) in tokens
+//   uint32_t tokens[num_tokens]          every response's ids back to back, [RESPONSE] excluded
+struct ResponseFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_memories;
+    uint64_t num_tokens;
+};
+
+class ResponseStore {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    struct Span {
+        const uint32_t* tokens;
+        size_t size;
+    };
+
+    void open(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(ResponseFileHeader)) throw std::runtime_error("response file too small: " + path);
+        header = reinterpret_cast<const ResponseFileHeader*>(file.data());
+        if (std::memcmp(header->magic, "FMMRESP", 8) != 0 || header->version != FORMAT_VERSION) {
+            throw std::runtime_error("not a response store (or wrong version): " + path);
+        }
+        offsets = reinterpret_cast<const uint64_t*>(file.data() + sizeof(ResponseFileHeader));
+        tokens = reinterpret_cast<const uint32_t*>(offsets + header->num_memories + 1);
+        if (reinterpret_cast<const char*>(tokens + header->num_tokens) > file.data() + file.size()) {
+            throw std::runtime_error("truncated response file: " + path);
+        }
+    }
+
+    bool is_open() const { return header != nullptr; }
+    uint64_t size() const { return header ? header->num_memories : 0; }
+
+    // Empty span for unknown memories.
+    Span response(uint64_t memory_idx) const {
+        if (!header || memory_idx >= header->num_memories) return Span{nullptr, 0};
+        return Span{tokens + offsets[memory_idx], static_cast<size_t>(offsets[memory_idx + 1] - offsets[memory_idx])};
+    }
+
+private:
+    MappedFile file;
+    const ResponseFileHeader* header = nullptr;
+    const uint64_t* offsets = nullptr;
+    const uint32_t* tokens = nullptr;
+};
+
+// Collects responses in memory-index order during training and writes responses.bin.
+class ResponseStoreWriter {
+public:
+    // Must be called once per memory, in memory-index order.
+    void append(const uint32_t* ids, size_t n) {
+        tokens.insert(tokens.end(), ids, ids + n);
+        offsets.push_back(tokens.size());
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+
+    void write(const std::string& outPath) const {
+        ResponseFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "FMMRESP", 8);
+        header.version = ResponseStore::FORMAT_VERSION;
+        header.num_memories = size();
+        header.num_tokens = tokens.size();
+
+        replace_file(outPath, [&](std::ofstream& out) {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+            out.write(reinterpret_cast<const char*>(tokens.data()), tokens.size() * sizeof(uint32_t));
+        });
+    }
+
+private:
+    std::vector<uint64_t> offsets = std::vector<uint64_t>(1, 0);
+    std::vector<uint32_t> tokens;
+};
+
+#endif // FMM_RESPONSES_HPP
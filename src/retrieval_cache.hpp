@@ -0,0 +1,125 @@
+// src/retrieval_cache.hpp (Bounded cache of ANN retrieval votes, keyed by the query vector)
+
+#ifndef FMM_RETRIEVAL_CACHE_HPP
+#define FMM_RETRIEVAL_CACHE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "vocab.hpp"
+
+// What one responding-mode retrieval decided: the voted first token and the closest memory
+// whose response starts with it.
+struct MemoryVote {
+    uint32_t token_id;
+    uint64_t memory_idx;
+};
+
+// Sharded CLOCK cache from query-vector hash to MemoryVote. Safe to share between threads;
+// each shard has its own lock, so concurrent lookups rarely contend.
+class RetrievalCache {
+public:
+    static constexpr size_t NUM_SHARDS = 16;
+
+    // capacity 0 disables the cache. count_cap > 0 clamps every bucket count to at most
+    // count_cap before hashing, so prompts differing only in how often a word repeats share
+    // an entry; 0 keys on the exact vector.
+    void configure(size_t capacity, uint32_t count_cap) {
+        std::unique_ptr<Shard[]> fresh(capacity > 0 ? new Shard[NUM_SHARDS] : nullptr);
+        for (size_t i = 0; fresh && i < NUM_SHARDS; ++i) {
+            fresh[i].capacity = (capacity + NUM_SHARDS - 1) / NUM_SHARDS;
+            fresh[i].entries.reserve(fresh[i].capacity);
+            fresh[i].index.reserve(fresh[i].capacity);
+        }
+        shards.swap(fresh);
+        this->count_cap = count_cap;
+        hit_count = 0;
+        miss_count = 0;
+    }
+
+    bool enabled() const { return shards != nullptr; }
+
+    uint64_t key_of(const std::vector<float>& query_vec) const {
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (size_t i = 0; i < query_vec.size(); ++i) {
+            if (query_vec[i] == 0.0f) continue;
+            uint32_t count = static_cast<uint32_t>(query_vec[i]);
+            if (count_cap > 0 && count > count_cap) count = count_cap;
+            h = vocab_hash::mix64(h ^ ((static_cast<uint64_t>(i) << 32) | count));
+        }
+        return h;
+    }
+
+    bool find(uint64_t key, MemoryVote& out) {
+        Shard& shard = shards[key % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            miss_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Entry& entry = shard.entries[it->second];
+        entry.referenced = true;
+        out = entry.vote;
+        hit_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void insert(uint64_t key, const MemoryVote& vote) {
+        Shard& shard = shards[key % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.entries[it->second].vote = vote;
+            return;
+        }
+        uint32_t slot;
+        if (shard.entries.size() < shard.capacity) {
+            slot = static_cast<uint32_t>(shard.entries.size());
+            shard.entries.push_back(Entry());
+        } else {
+            // CLOCK: skip (and clear) recently used entries, evict the first cold one.
+            while (shard.entries[shard.hand].referenced) {
+                shard.entries[shard.hand].referenced = false;
+                shard.hand = (shard.hand + 1) % shard.entries.size();
+            }
+            slot = static_cast<uint32_t>(shard.hand);
+            shard.hand = (shard.hand + 1) % shard.entries.size();
+            shard.index.erase(shard.entries[slot].key);
+        }
+        shard.entries[slot] = Entry{key, vote, false};
+        shard.index[key] = slot;
+    }
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+    double hit_rate() const {
+        uint64_t total = hits() + misses();
+        return total ? static_cast<double>(hits()) / total : 0.0;
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        MemoryVote vote;
+        bool referenced;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+        std::unordered_map<uint64_t, uint32_t> index;
+        size_t hand = 0;
+        size_t capacity = 0;
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    uint32_t count_cap = 0;
+    std::atomic<uint64_t> hit_count{0};
+    std::atomic<uint64_t> miss_count{0};
+};
+
+#endif // FMM_RETRIEVAL_CACHE_HPP
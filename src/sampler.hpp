@@ -0,0 +1,137 @@
+// src/sampler.hpp (Seedable, allocation-free top-K / top-p sampler)
+
+#ifndef FMM_SAMPLER_HPP
+#define FMM_SAMPLER_HPP
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <random>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "metrics.hpp"
+
+// xoshiro256** (Blackman & Vigna). 32 bytes of state, no syscalls after seeding.
+class Xoshiro256 {
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+public:
+    explicit Xoshiro256(uint64_t seed = 0) { reseed(seed); }
+
+    // Expand a single 64-bit seed into the full state with splitmix64.
+    void reseed(uint64_t seed) {
+        for (auto& word : s) {
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform double in [0, 1) from the top 53 bits.
+    double uniform() { return (next() >> 11) * 0x1.0p-53; }
+};
+
+struct SamplerConfig {
+    int top_k = 40;            // <= 0 disables the top-K cut
+    float top_p = 1.0f;        // nucleus mass kept after top-K; 1.0 disables it
+    float temperature = 1.0f;  // scores are raised to 1/temperature before sampling
+    bool fixed_seed = false;   // if false, the seed is drawn once from std::random_device
+    uint64_t seed = 0;
+};
+
+// Samples a token id from a dense, non-negative score vector. The candidate buffer is
+// reserved once and reused, so steady-state sampling performs no heap allocations.
+class Sampler {
+public:
+    static constexpr uint32_t NO_CANDIDATES = UINT32_MAX;
+    static constexpr uint32_t NO_CONFIDENCE = UINT32_MAX - 1;
+
+    explicit Sampler(const SamplerConfig& cfg = SamplerConfig()) { configure(cfg); }
+
+    void configure(const SamplerConfig& cfg) {
+        config = cfg;
+        rng.reseed(cfg.fixed_seed ? cfg.seed : (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}());
+    }
+
+    const SamplerConfig& get_config() const { return config; }
+
+    void reseed(uint64_t seed) { rng.reseed(seed); }
+
+    void reserve(size_t vocab_size) { candidates.reserve(vocab_size); }
+
+    uint32_t sample(const float* scores, size_t n) {
+        metrics::StageTimer timer(metrics::TOP_K);
+        candidates.clear();
+        for (uint32_t i = 0; i < n; ++i) {
+            if (scores[i] > 1e-9) candidates.push_back({scores[i], i});
+        }
+        if (candidates.empty()) return NO_CANDIDATES;
+
+        auto by_score_desc = [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+            return a.first > b.first || (a.first == b.first && a.second > b.second);
+        };
+        size_t keep = candidates.size();
+        if (config.top_k > 0 && keep > static_cast<size_t>(config.top_k)) keep = config.top_k;
+        std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end(), by_score_desc);
+        timer.next(metrics::SAMPLE);
+
+        if (config.temperature > 0.0f && config.temperature != 1.0f) {
+            const float inv_t = 1.0f / config.temperature;
+            const float top = candidates[0].first;
+            // Normalise by the leader first so small temperatures cannot overflow.
+            for (size_t i = 0; i < keep; ++i) candidates[i].first = std::pow(candidates[i].first / top, inv_t);
+        } else if (config.temperature <= 0.0f) {
+            return candidates[0].second; // greedy
+        }
+
+        double total_score = 0.0;
+        for (size_t i = 0; i < keep; ++i) total_score += candidates[i].first;
+        if (total_score < 1e-9) return NO_CONFIDENCE;
+
+        if (config.top_p < 1.0f) {
+            const double limit = total_score * config.top_p;
+            double cumulative = 0.0;
+            size_t nucleus = 0;
+            while (nucleus < keep) {
+                cumulative += candidates[nucleus++].first;
+                if (cumulative >= limit) break;
+            }
+            keep = nucleus;
+            total_score = cumulative;
+        }
+
+        const double sample = rng.uniform() * total_score;
+        double cumulative_score = 0.0;
+        for (size_t i = 0; i < keep; ++i) {
+            cumulative_score += candidates[i].first;
+            if (sample < cumulative_score) return candidates[i].second;
+        }
+        return candidates[0].second;
+    }
+
+    uint32_t sample(const std::vector<float>& scores) { return sample(scores.data(), scores.size()); }
+
+private:
+    SamplerConfig config;
+    Xoshiro256 rng;
+    std::vector<std::pair<float, uint32_t>> candidates;
+};
+
+#endif // FMM_SAMPLER_HPP
@@ -0,0 +1,176 @@
+// src/server.cpp (Continuous-batching scheduler and socket server)
+
+#include "server.hpp"
+#include "protocol.hpp"
+#include <iostream>
+#include <algorithm>
+#include <csignal>
+#include <poll.h>
+#include <omp.h>
+
+namespace {
+volatile std::sig_atomic_t stop_requested = 0;
+void on_stop_signal(int) { stop_requested = 1; }
+}
+
+Scheduler::Scheduler(const InferenceEngine& engine, size_t max_active, const GenerationOptions& defaults)
+    : engine(engine), max_active(std::max<size_t>(1, max_active)), defaults(defaults)
+{
+    for (int i = 0; i < omp_get_max_threads(); ++i) contexts.push_back(engine.create_context());
+    thread = std::thread(&Scheduler::run, this);
+}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+std::future<Completion> Scheduler::submit(const std::string& prompt, uint32_t max_tokens) {
+    std::unique_ptr<Request> req(new Request());
+    req->prompt = prompt;
+    req->state.options = defaults;
+    req->state.options.max_tokens = max_tokens;
+    std::future<Completion> result = req->result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            req->result.set_value(Completion());
+            return result;
+        }
+        pending.push_back(std::move(req));
+    }
+    wake.notify_one();
+    return result;
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (thread.joinable()) thread.join();
+}
+
+// One decode step; a request's prompt is encoded on its first. Returns whether a token
+// was produced. Runs inside the batch's parallel loop, which an exception must not leave:
+// a failing request stops with StopReason::ERROR and keeps the text it has so far.
+bool Scheduler::step(Request& req, InferenceContext& ctx) {
+    try {
+        if (!req.started) {
+            req.started = true;
+            engine.begin_generation(ctx, req.prompt, req.state.options, req.state);
+        }
+        uint32_t id = engine.generate_step(ctx, req.state);
+        if (id == InferenceEngine::NO_TOKEN) return false;
+        req.completion.text += engine.token_view(id);
+        req.completion.num_tokens = req.state.stats.num_tokens;
+        return true;
+    } catch (const std::exception& e) {
+        ctx.txn.reset();
+        std::cerr << "Error during generation: " << e.what() << std::endl;
+        req.state.stats.stop_reason = StopReason::ERROR;
+        return false;
+    }
+}
+
+void Scheduler::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !pending.empty() || !active.empty(); });
+            if (stopping) break;
+            // Admit queued generations into the free slots of the running batch.
+            while (!pending.empty() && active.size() < max_active) {
+                active.push_back(std::move(pending.front()));
+                pending.pop_front();
+            }
+        }
+
+        const long n = static_cast<long>(active.size());
+        uint64_t produced = 0;
+        #pragma omp parallel for schedule(dynamic, 1) reduction(+:produced)
+        for (long i = 0; i < n; ++i) {
+            produced += step(*active[i], *contexts[omp_get_thread_num()]);
+        }
+        num_steps.fetch_add(1);
+        num_tokens.fetch_add(produced);
+
+        // Retire finished generations; their slots are refilled at the top of the next step.
+        auto first_done = std::stable_partition(active.begin(), active.end(),
+            [](const std::unique_ptr<Request>& req) { return !req->state.finished(); });
+        for (auto it = first_done; it != active.end(); ++it) (*it)->result.set_value(std::move((*it)->completion));
+        active.erase(first_done, active.end());
+    }
+
+    // Shutting down: hand back whatever each generation has so far.
+    for (auto& req : active) req->result.set_value(std::move(req->completion));
+    active.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& req : pending) req->result.set_value(Completion());
+    pending.clear();
+}
+
+static GenerationOptions generation_defaults(const ServerConfig& config) {
+    GenerationOptions options;
+    options.whole_response = config.whole_response;
+    return options;
+}
+
+Server::Server(const InferenceEngine& engine, const ServerConfig& config)
+    : config(config), scheduler(engine, config.max_active, generation_defaults(config)) {}
+
+void Server::serve_connection(Connection& conn) {
+    std::string prompt;
+    uint32_t max_tokens;
+    while (protocol::read_frame(conn.fd, prompt, max_tokens)) {
+        if (max_tokens == 0) max_tokens = config.default_max_tokens;
+        max_tokens = std::min(max_tokens, config.max_tokens_limit);
+        Completion completion = scheduler.submit(prompt, max_tokens).get();
+        if (!protocol::write_frame(conn.fd, completion.text, completion.num_tokens)) break;
+    }
+    conn.finished = true;
+}
+
+void Server::reap_connections(bool all) {
+    auto it = connections.begin();
+    while (it != connections.end()) {
+        Connection& conn = **it;
+        if (all && !conn.finished) ::shutdown(conn.fd, SHUT_RDWR);
+        if (all || conn.finished) {
+            conn.thread.join();
+            ::close(conn.fd); // closed only after the join, so the fd cannot be reused under shutdown()
+            it = connections.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Server::run() {
+    int listen_fd = protocol::listen_on(config.address);
+    struct sigaction action = {};
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    std::cout << "Serving on " << config.address << " (max " << config.max_active << " active generations, "
+              << omp_get_max_threads() << " threads)." << std::endl;
+
+    while (!stop_requested) {
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 250) <= 0) continue;
+        int client_fd = ::accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0) continue;
+        reap_connections(false);
+        connections.emplace_back(new Connection());
+        Connection& conn = *connections.back();
+        conn.fd = client_fd;
+        conn.thread = std::thread(&Server::serve_connection, this, std::ref(conn));
+    }
+
+    std::cout << "Shutting down after " << scheduler.steps() << " steps, " << scheduler.tokens() << " tokens." << std::endl;
+    ::close(listen_fd);
+    if (protocol::is_unix_address(config.address)) ::unlink(config.address.substr(5).c_str());
+    // Stop the scheduler first so blocked connection threads get their (partial) results.
+    scheduler.stop();
+    reap_connections(true);
+}
@@ -0,0 +1,98 @@
+// src/server.hpp (`fmm serve`: socket front end and continuous-batching scheduler)
+
+#ifndef FMM_SERVER_HPP
+#define FMM_SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <cstdint>
+#include "inference.hpp"
+
+struct ServerConfig {
+    std::string address = "unix:/tmp/fmm.sock";
+    size_t max_active = 256;             // generations decoded together in one step
+    uint32_t default_max_tokens = 80;    // used when a request asks for 0
+    uint32_t max_tokens_limit = 1024;
+    bool whole_response = false;         // see GenerationOptions::whole_response
+};
+
+struct Completion {
+    std::string text;
+    uint32_t num_tokens = 0;
+};
+
+// Runs the decode steps of many generations interleaved. Each step advances every active
+// generation by one token across the OpenMP thread team; finished generations leave and
+// queued ones join between steps, so a long request never holds a batch slot it is not
+// using and throughput is bounded by CPU rather than by the slowest request.
+class Scheduler {
+public:
+    Scheduler(const InferenceEngine& engine, size_t max_active, const GenerationOptions& defaults = GenerationOptions());
+    ~Scheduler();
+
+    std::future<Completion> submit(const std::string& prompt, uint32_t max_tokens);
+    void stop();
+
+    uint64_t steps() const { return num_steps.load(); }
+    uint64_t tokens() const { return num_tokens.load(); }
+
+private:
+    struct Request {
+        std::string prompt;
+        bool started = false;
+        GenerationState state;
+        Completion completion;
+        std::promise<Completion> result;
+    };
+
+    void run();
+    bool step(Request& req, InferenceContext& ctx);
+
+    const InferenceEngine& engine;
+    size_t max_active;
+    GenerationOptions defaults;
+    std::vector<std::unique_ptr<InferenceContext>> contexts; // one per OpenMP thread
+    std::vector<std::unique_ptr<Request>> active;            // owned by the scheduler thread
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::unique_ptr<Request>> pending;
+    bool stopping = false;
+
+    std::atomic<uint64_t> num_steps{0};
+    std::atomic<uint64_t> num_tokens{0};
+    std::thread thread;
+};
+
+// Accepts connections on a Unix or loopback TCP socket and feeds their requests to the
+// scheduler, one thread per connection. See protocol.hpp for the wire format.
+class Server {
+public:
+    Server(const InferenceEngine& engine, const ServerConfig& config);
+
+    // Blocks until SIGINT or SIGTERM, then drains connections and returns.
+    void run();
+
+private:
+    struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    void serve_connection(Connection& conn);
+    void reap_connections(bool all);
+
+    ServerConfig config;
+    Scheduler scheduler;
+    std::vector<std::unique_ptr<Connection>> connections;
+};
+
+#endif // FMM_SERVER_HPP
@@ -0,0 +1,145 @@
+// src/tokenizer.hpp (Single-pass, allocation-free word tokenizer)
+
+#ifndef FMM_TOKENIZER_HPP
+#define FMM_TOKENIZER_HPP
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include "vocab.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Same output as tokenize() in utils.hpp: split on whitespace, drop punctuation,
+// lowercase, skip tokens that end up empty. The input is scanned once and lowercased into
+// an arena owned by the tokenizer; tokens are string_views into it, valid until the next
+// call.
+class WordTokenizer {
+public:
+    enum CharClass : uint8_t { KEEP = 0, SPACE = 1, PUNCT = 2, UPPER = 3 };
+
+    WordTokenizer() = default;
+    WordTokenizer(const WordTokenizer&) = delete;
+    WordTokenizer& operator=(const WordTokenizer&) = delete;
+    WordTokenizer(WordTokenizer&&) = default;
+    WordTokenizer& operator=(WordTokenizer&&) = default;
+
+    const std::vector<std::string_view>& tokenize(std::string_view input) {
+        reserve_arena(input.size());
+        tokens.clear();
+        char* out = arena.get();
+        char* token_start = out;
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(input.data());
+        const unsigned char* end = p + input.size();
+
+        while (p < end) {
+#if defined(__AVX2__)
+            // Classify 32 bytes at a time. Everything in front of the next punctuation byte
+            // is lowercased and stored as-is (spaces included, no view covers them), and
+            // token boundaries are read off the space bitmask. The store may spill past the
+            // processed prefix into arena slack, which later bytes overwrite.
+            while (end - p >= 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                uint32_t punct = static_cast<uint32_t>(_mm256_movemask_epi8(punct_mask(v)));
+                uint32_t space = static_cast<uint32_t>(_mm256_movemask_epi8(space_mask(v)));
+                uint32_t n = punct ? static_cast<uint32_t>(__builtin_ctz(punct)) : 32;
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), to_lower(v));
+                if (n < 32) space &= (1u << n) - 1;
+                while (space) {
+                    uint32_t i = static_cast<uint32_t>(__builtin_ctz(space));
+                    if (out + i != token_start) tokens.emplace_back(token_start, out + i - token_start);
+                    token_start = out + i + 1;
+                    space &= space - 1;
+                }
+                p += n;
+                out += n;
+                if (n < 32) break;
+            }
+            if (p == end) break;
+#endif
+            switch (char_class()[*p]) {
+                case KEEP:  *out++ = static_cast<char>(*p); break;
+                case UPPER: *out++ = static_cast<char>(*p + ('a' - 'A')); break;
+                case SPACE:
+                    if (out != token_start) tokens.emplace_back(token_start, out - token_start);
+                    *out++ = ' ';
+                    token_start = out;
+                    break;
+                case PUNCT: break;
+            }
+            ++p;
+        }
+        if (out != token_start) tokens.emplace_back(token_start, out - token_start);
+        return tokens;
+    }
+
+    // Tokenizes and resolves each word through the vocabulary, skipping unknown words.
+    const std::vector<uint32_t>& tokenize_ids(std::string_view input, const CompiledVocab& vocab) {
+        ids.clear();
+        for (std::string_view token : tokenize(input)) {
+            uint32_t id = vocab.lookup(token);
+            if (id != CompiledVocab::NOT_FOUND) ids.push_back(id);
+        }
+        return ids;
+    }
+
+    // Classification matching isspace/ispunct/isupper in the "C" locale. Bytes >= 0x80
+    // are kept verbatim, as std::tolower leaves them unchanged there.
+    static const uint8_t* char_class() {
+        static const struct Table {
+            uint8_t t[256];
+            Table() {
+                for (int c = 0; c < 256; ++c) {
+                    if (c == ' ' || (c >= '\t' && c <= '\r')) t[c] = SPACE;
+                    else if (c >= 'A' && c <= 'Z') t[c] = UPPER;
+                    else if ((c >= '!' && c <= '/') || (c >= ':' && c <= '@') || (c >= '[' && c <= '`') || (c >= '{' && c <= '~')) t[c] = PUNCT;
+                    else t[c] = KEEP;
+                }
+            }
+        } table;
+        return table.t;
+    }
+
+private:
+    std::unique_ptr<char[]> arena;
+    size_t arena_capacity = 0;
+    std::vector<std::string_view> tokens;
+    std::vector<uint32_t> ids;
+
+    // Output never exceeds the input length (plus one vector store of slack); grow geometrically so the arena settles.
+    // The views from the previous call are invalidated either way.
+    void reserve_arena(size_t n) {
+        if (n + 32 <= arena_capacity) return;
+        size_t cap = arena_capacity ? arena_capacity : 256;
+        while (cap < n + 32) cap *= 2;
+        arena.reset(new char[cap]);
+        arena_capacity = cap;
+    }
+
+#if defined(__AVX2__)
+    static __m256i in_range(__m256i v, char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+    }
+
+    // Signed byte compares: bytes >= 0x80 are negative and fall in no range, as in the table.
+    static __m256i space_mask(__m256i v) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range(v, '\t', '\r'));
+    }
+
+    static __m256i punct_mask(__m256i v) {
+        return _mm256_or_si256(_mm256_or_si256(in_range(v, '!', '/'), in_range(v, ':', '@')),
+                               _mm256_or_si256(in_range(v, '[', '`'), in_range(v, '{', '~')));
+    }
+
+    static __m256i to_lower(__m256i v) {
+        return _mm256_add_epi8(v, _mm256_and_si256(in_range(v, 'A', 'Z'), _mm256_set1_epi8('a' - 'A')));
+    }
+#endif
+};
+
+#endif // FMM_TOKENIZER_HPP
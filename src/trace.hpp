@@ -0,0 +1,183 @@
+// src/trace.hpp (Per-thread trace spans, written as Chrome / Perfetto trace-event JSON)
+
+#ifndef FMM_TRACE_HPP
+#define FMM_TRACE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// Off by default; while off, a span is one relaxed load and a branch. While on, each thread
+// appends complete events ("ph":"X") to its own ring of RING_EVENTS, overwriting its oldest,
+// so a long run keeps its most recent history at a fixed cost. write_json() lays the rings of
+// all threads side by side on one timeline (chrome://tracing, ui.perfetto.dev).
+//
+// Span names and categories are stored as pointers: pass string literals.
+namespace trace {
+
+const size_t RING_EVENTS = 1 << 16;
+
+struct Event {
+    const char* name;
+    const char* category;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+// Nanoseconds since the first call in this process; all threads share the origin.
+inline uint64_t now_ns() {
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point origin = clock::now();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin).count());
+}
+
+namespace detail {
+
+struct Ring {
+    explicit Ring(uint32_t tid) : events(new Event[RING_EVENTS]), tid(tid) {}
+
+    std::unique_ptr<Event[]> events;
+    std::atomic<uint64_t> written{0}; // events ever appended; the slot of event i is i % RING_EVENTS
+    uint32_t tid;
+
+    // Only the owning thread appends.
+    void append(const Event& event) {
+        uint64_t i = written.load(std::memory_order_relaxed);
+        events[i % RING_EVENTS] = event;
+        written.store(i + 1, std::memory_order_release);
+    }
+
+    // The events still held, oldest first. Copies what a concurrent append may have
+    // overwritten meanwhile, then drops it again.
+    void collect(std::vector<Event>& out) const {
+        uint64_t end = written.load(std::memory_order_acquire);
+        uint64_t begin = end > RING_EVENTS ? end - RING_EVENTS : 0;
+        size_t base = out.size();
+        for (uint64_t i = begin; i < end; ++i) out.push_back(events[i % RING_EVENTS]);
+        uint64_t now = written.load(std::memory_order_acquire);
+        uint64_t overwritten = now > RING_EVENTS ? now - RING_EVENTS : 0;
+        if (overwritten > begin) {
+            size_t drop = static_cast<size_t>(std::min(overwritten, end) - begin);
+            out.erase(out.begin() + base, out.begin() + base + drop);
+        }
+    }
+};
+
+// One ring per thread that ever recorded, kept for the life of the process so its events
+// outlast the thread.
+class Registry {
+public:
+    Ring* create() {
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.emplace_back(new Ring(static_cast<uint32_t>(rings.size() + 1)));
+        return rings.back().get();
+    }
+
+    template<typename F>
+    void for_each(F&& fn) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& ring : rings) fn(*ring);
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+// Never destroyed: threads (OpenMP workers among them) may exit after static destructors ran.
+inline Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+inline std::atomic<bool>& enabled_flag() {
+    static std::atomic<bool> flag{false};
+    return flag;
+}
+
+inline Ring& local() {
+    thread_local Ring* ring = registry().create();
+    return *ring;
+}
+
+} // namespace detail
+
+inline bool enabled() { return detail::enabled_flag().load(std::memory_order_relaxed); }
+inline void enable(bool on) {
+    now_ns(); // fix the origin before the first event
+    detail::enabled_flag().store(on, std::memory_order_relaxed);
+}
+
+// A span whose start was taken with now_ns() elsewhere, e.g. across calls.
+inline void complete(const char* name, const char* category, uint64_t start_ns, uint64_t end_ns) {
+    if (!enabled()) return;
+    detail::local().append(Event{name, category, start_ns, end_ns > start_ns ? end_ns - start_ns : 0});
+}
+
+// Records the scope it lives in. Inert if tracing was off when it was created.
+class Span {
+public:
+    Span(const char* name, const char* category) : name(name), category(category), active(enabled()) {
+        if (active) start = now_ns();
+    }
+    ~Span() {
+        if (active) complete(name, category, start, now_ns());
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    bool active;
+    uint64_t start = 0;
+};
+
+inline std::string json() {
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char ts[64];
+    std::vector<Event> events;
+    detail::registry().for_each([&](const detail::Ring& ring) {
+        events.clear();
+        ring.collect(events);
+        if (events.empty()) return;
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.tid
+            << ",\"args\":{\"name\":\"thread " << ring.tid << "\"}}";
+        first = false;
+        for (const Event& e : events) {
+            // Timestamps are in microseconds; keep the nanoseconds as decimals.
+            std::snprintf(ts, sizeof(ts), "\"ts\":%.3f,\"dur\":%.3f", e.start_ns / 1000.0, e.duration_ns / 1000.0);
+            out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\"," << ts
+                << ",\"pid\":1,\"tid\":" << ring.tid << "}";
+        }
+    });
+    out << "\n]}\n";
+    return out.str();
+}
+
+inline void write_json(const std::string& outPath) {
+    std::string text = json();
+    replace_file(outPath, [&](std::ofstream& out) { out << text; });
+}
+
+} // namespace trace
+
+#define FMM_TRACE_CONCAT_(a, b) a##b
+#define FMM_TRACE_CONCAT(a, b) FMM_TRACE_CONCAT_(a, b)
+// Traces the rest of the enclosing scope: FMM_TRACE_SPAN("train", "count_statistics");
+#define FMM_TRACE_SPAN(category, name) trace::Span FMM_TRACE_CONCAT(fmm_trace_span_, __LINE__)(name, category)
+
+#endif // FMM_TRACE_HPP
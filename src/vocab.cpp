@@ -0,0 +1,121 @@
+// src/vocab.cpp (Compiler for the mmap-loaded vocabulary)
+
+#include "vocab.hpp"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <string_view>
+#include <cstdio>
+
+#include "nlohmann/json.hpp"
+
+void compile_vocab(const std::vector<std::pair<std::string, uint32_t>>& entries, const std::string& outPath) {
+    const uint32_t num_tokens = static_cast<uint32_t>(entries.size());
+    uint32_t id_space = 0;
+    for (const auto& e : entries) id_space = std::max(id_space, e.second + 1);
+
+    // String pool indexed by id. Missing ids get an empty range.
+    std::vector<const std::string*> by_id(id_space, nullptr);
+    for (const auto& e : entries) {
+        if (by_id[e.second]) throw std::runtime_error("duplicate token id " + std::to_string(e.second));
+        by_id[e.second] = &e.first;
+    }
+    // Two equal keys hash alike under every seed, so the seed search below could never
+    // separate them.
+    std::unordered_map<std::string_view, uint32_t> by_text;
+    by_text.reserve(entries.size());
+    for (const auto& e : entries) {
+        auto inserted = by_text.emplace(e.first, e.second);
+        if (!inserted.second) {
+            throw std::runtime_error("duplicate token string '" + e.first + "' (ids " + std::to_string(inserted.first->second) +
+                                     " and " + std::to_string(e.second) + ")");
+        }
+    }
+    std::vector<uint32_t> offsets(static_cast<size_t>(id_space) + 1, 0);
+    std::string pool;
+    for (uint32_t id = 0; id < id_space; ++id) {
+        offsets[id] = static_cast<uint32_t>(pool.size());
+        if (by_id[id]) pool += *by_id[id];
+    }
+    offsets[id_space] = static_cast<uint32_t>(pool.size());
+
+    // CHD: hash keys into buckets of ~4, then place the largest buckets first, searching
+    // for a per-bucket seed that sends every key of the bucket to a distinct free slot.
+    const uint32_t num_buckets = std::max<uint32_t>(1, (num_tokens + 3) / 4);
+    std::vector<uint64_t> hashes(num_tokens);
+    std::vector<std::vector<uint32_t>> buckets(num_buckets);
+    for (uint32_t i = 0; i < num_tokens; ++i) {
+        hashes[i] = vocab_hash::hash_bytes(entries[i].first.data(), entries[i].first.size());
+        buckets[vocab_hash::bucket_of(hashes[i], num_buckets)].push_back(i);
+    }
+    std::vector<uint32_t> order(num_buckets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    std::vector<uint32_t> bucket_seeds(num_buckets, 0);
+    std::vector<uint32_t> slot_to_id(num_tokens, 0);
+    std::vector<bool> taken(num_tokens, false);
+    std::vector<uint32_t> trial;
+    for (uint32_t b : order) {
+        const auto& keys = buckets[b];
+        if (keys.empty()) break;
+        uint32_t seed = 0;
+        for (;; ++seed) {
+            if (seed == UINT32_MAX) throw std::runtime_error("perfect hash construction failed");
+            trial.clear();
+            bool ok = true;
+            for (uint32_t k : keys) {
+                uint32_t slot = vocab_hash::slot_of(hashes[k], seed, num_tokens);
+                if (taken[slot] || std::find(trial.begin(), trial.end(), slot) != trial.end()) { ok = false; break; }
+                trial.push_back(slot);
+            }
+            if (ok) break;
+        }
+        bucket_seeds[b] = seed;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            taken[trial[i]] = true;
+            slot_to_id[trial[i]] = entries[keys[i]].second;
+        }
+    }
+
+    VocabFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "FMMVOCAB", 8);
+    header.version = CompiledVocab::FORMAT_VERSION;
+    header.num_tokens = num_tokens;
+    header.id_space = id_space;
+    header.num_buckets = num_buckets;
+    header.pool_size = static_cast<uint32_t>(pool.size());
+
+    replace_file(outPath, [&](std::ofstream& out) {
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(bucket_seeds.data()), bucket_seeds.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(slot_to_id.data()), slot_to_id.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+        out.write(pool.data(), pool.size());
+    });
+}
+
+void compile_vocab_from_tokenizer(const std::string& tokenizerPath, const std::string& outPath) {
+    std::ifstream in(tokenizerPath);
+    if (!in.is_open()) throw std::runtime_error("Could not open tokenizer file at " + tokenizerPath);
+    nlohmann::json j = nlohmann::json::parse(in);
+
+    std::vector<std::pair<std::string, uint32_t>> entries;
+    const nlohmann::json& vocab = (j.contains("model") && j["model"].contains("vocab")) ? j["model"]["vocab"] : j;
+    for (auto it = vocab.begin(); it != vocab.end(); ++it) {
+        entries.emplace_back(it.key(), it.value().get<uint32_t>());
+    }
+    if (j.contains("added_tokens")) {
+        for (const auto& added : j["added_tokens"]) {
+            std::string content = added["content"].get<std::string>();
+            uint32_t id = added["id"].get<uint32_t>();
+            bool present = std::any_of(entries.begin(), entries.end(), [&](const std::pair<std::string, uint32_t>& e) { return e.second == id; });
+            if (!present) entries.emplace_back(content, id);
+        }
+    }
+    std::cout << "Compiling vocabulary of " << entries.size() << " tokens to " << outPath << std::endl;
+    compile_vocab(entries, outPath);
+}
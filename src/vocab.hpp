@@ -0,0 +1,134 @@
+// src/vocab.hpp (Precompiled, mmap-loaded vocabulary with a minimal perfect hash)
+
+#ifndef FMM_VOCAB_HPP
+#define FMM_VOCAB_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "mapped_file.hpp"
+
+// On-disk layout of vocab.bin (all fields native-endian, 4-byte aligned):
+//   VocabFileHeader
+//   uint32_t bucket_seeds[num_buckets]   displacement seed per CHD bucket
+//   uint32_t slot_to_id[num_tokens]      perfect-hash slot -> token id
+//   uint32_t offsets[id_space + 1]       token id -> [offsets[id], offsets[id+1]) in pool
+//   char     pool[pool_size]             all token strings back to back
+struct VocabFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tokens;
+    uint32_t id_space;
+    uint32_t num_buckets;
+    uint32_t pool_size;
+    uint32_t reserved;
+};
+
+namespace vocab_hash {
+
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Single pass over the key, eight bytes at a time.
+inline uint64_t hash_bytes(const char* s, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (n * 0xC2B2AE3D27D4EB4FULL);
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, s, 8);
+        h = (h ^ mix64(w)) * 0x9FB21C651E98DF25ULL;
+        s += 8;
+        n -= 8;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, s, n);
+    return mix64(h ^ tail);
+}
+
+inline uint32_t reduce(uint64_t x, uint32_t n) {
+    return static_cast<uint32_t>((static_cast<unsigned __int128>(x) * n) >> 64);
+}
+
+inline uint32_t bucket_of(uint64_t h, uint32_t num_buckets) { return reduce(h, num_buckets); }
+
+inline uint32_t slot_of(uint64_t h, uint32_t seed, uint32_t num_tokens) {
+    return reduce(mix64(h ^ (seed * 0x9E3779B97F4A7C15ULL + 1)), num_tokens);
+}
+
+} // namespace vocab_hash
+
+class CompiledVocab {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    CompiledVocab() = default;
+    explicit CompiledVocab(const std::string& path) { open(path); }
+
+    void open(const std::string& path) {
+        file.open(path);
+        if (file.size() < sizeof(VocabFileHeader)) throw std::runtime_error("vocab file too small: " + path);
+        header = reinterpret_cast<const VocabFileHeader*>(file.data());
+        if (std::memcmp(header->magic, "FMMVOCAB", 8) != 0 || header->version != FORMAT_VERSION) {
+            throw std::runtime_error("not a compiled vocabulary (or wrong version): " + path);
+        }
+        const char* p = file.data() + sizeof(VocabFileHeader);
+        bucket_seeds = reinterpret_cast<const uint32_t*>(p);
+        p += sizeof(uint32_t) * header->num_buckets;
+        slot_to_id = reinterpret_cast<const uint32_t*>(p);
+        p += sizeof(uint32_t) * header->num_tokens;
+        offsets = reinterpret_cast<const uint32_t*>(p);
+        p += sizeof(uint32_t) * (static_cast<size_t>(header->id_space) + 1);
+        pool = p;
+        if (pool + header->pool_size > file.data() + file.size()) throw std::runtime_error("truncated vocab file: " + path);
+    }
+
+    bool is_open() const { return header != nullptr; }
+    uint32_t size() const { return header ? header->num_tokens : 0; }
+    // One past the largest token id; dense per-token arrays are sized with this.
+    uint32_t id_space() const { return header ? header->id_space : 0; }
+
+    // One hash, one slot read and one memcmp.
+    uint32_t lookup(std::string_view token) const {
+        if (!header || header->num_tokens == 0) return NOT_FOUND;
+        uint64_t h = vocab_hash::hash_bytes(token.data(), token.size());
+        uint32_t seed = bucket_seeds[vocab_hash::bucket_of(h, header->num_buckets)];
+        uint32_t id = slot_to_id[vocab_hash::slot_of(h, seed, header->num_tokens)];
+        uint32_t begin = offsets[id], len = offsets[id + 1] - begin;
+        if (len != token.size() || std::memcmp(pool + begin, token.data(), len) != 0) return NOT_FOUND;
+        return id;
+    }
+
+    bool contains(std::string_view token) const { return lookup(token) != NOT_FOUND; }
+
+    // Empty view for ids in the id space that have no token.
+    std::string_view token(uint32_t id) const {
+        if (!header || id >= header->id_space) return std::string_view();
+        return std::string_view(pool + offsets[id], offsets[id + 1] - offsets[id]);
+    }
+
+private:
+    MappedFile file;
+    const VocabFileHeader* header = nullptr;
+    const uint32_t* bucket_seeds = nullptr;
+    const uint32_t* slot_to_id = nullptr;
+    const uint32_t* offsets = nullptr;
+    const char* pool = nullptr;
+};
+
+// Builds vocab.bin from (token, id) pairs. Ids need not be contiguous.
+void compile_vocab(const std::vector<std::pair<std::string, uint32_t>>& entries, const std::string& outPath);
+
+// Reads a HuggingFace tokenizer.json (model.vocab plus added_tokens) and compiles it.
+void compile_vocab_from_tokenizer(const std::string& tokenizerPath, const std::string& outPath);
+
+#endif // FMM_VOCAB_HPP